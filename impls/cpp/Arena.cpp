@@ -0,0 +1,134 @@
+#include "Arena.h"
+
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Blocks are aligned to their size, so the block an object was carved
+// from, and its arena, can be found by masking the object's address.
+static const size_t blockSize       = 64 * 1024;
+static const size_t maxObjectSize   = 1024;
+static const size_t alignment       = 8;
+
+struct Arena::Block {
+    Arena* arena;
+    Block* next;
+};
+
+static thread_local Arena*      s_current = NULL;
+static thread_local const void* s_lastAllocation = NULL;
+
+static size_t roundUp(size_t size)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+Arena::Scope::Scope(bool useArena)
+: m_arena(useArena ? new Arena : NULL)
+, m_previous(s_current)
+{
+    s_current = m_arena;
+}
+
+Arena::Scope::~Scope()
+{
+    s_current = m_previous;
+    s_lastAllocation = NULL;
+    if (m_arena != NULL) {
+        m_arena->unref();
+    }
+}
+
+Arena::Arena()
+: m_blocks(NULL)
+, m_top(NULL)
+, m_limit(NULL)
+, m_liveCount(1)
+{
+
+}
+
+Arena::~Arena()
+{
+    while (m_blocks != NULL) {
+        Block* next = m_blocks->next;
+        free(m_blocks);
+        m_blocks = next;
+    }
+}
+
+void* Arena::allocate(size_t size)
+{
+    Arena* arena = s_current;
+    if ((arena == NULL) || (size > maxObjectSize)) {
+        return NULL;
+    }
+    void* p = arena->allocateFrom(size);
+    s_lastAllocation = p;
+    return p;
+}
+
+bool Arena::claim(const void* p)
+{
+    if ((p == NULL) || (p != s_lastAllocation)) {
+        return false;
+    }
+    s_lastAllocation = NULL;
+    return true;
+}
+
+bool Arena::owns(const void* p)
+{
+    Arena* arena = s_current;
+    if (arena == NULL) {
+        return false;
+    }
+    const Block* block = reinterpret_cast<const Block*>(
+        reinterpret_cast<uintptr_t>(p) & ~(blockSize - 1));
+    for (const Block* it = arena->m_blocks; it != NULL; it = it->next) {
+        if (it == block) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Arena::release(const void* p)
+{
+    const Block* block = reinterpret_cast<const Block*>(
+        reinterpret_cast<uintptr_t>(p) & ~(blockSize - 1));
+    block->arena->unref();
+}
+
+void* Arena::allocateFrom(size_t size)
+{
+    size = roundUp(size);
+    if (static_cast<size_t>(m_limit - m_top) < size) {
+        addBlock();
+    }
+    void* p = m_top;
+    m_top += size;
+    ++m_liveCount;
+    return p;
+}
+
+void Arena::addBlock()
+{
+    void* memory;
+    if (posix_memalign(&memory, blockSize, blockSize) != 0) {
+        throw std::bad_alloc();
+    }
+    Block* block = static_cast<Block*>(memory);
+    block->arena = this;
+    block->next = m_blocks;
+    m_blocks = block;
+    m_top   = static_cast<char*>(memory) + roundUp(sizeof(Block));
+    m_limit = static_cast<char*>(memory) + blockSize;
+}
+
+void Arena::unref()
+{
+    if (--m_liveCount == 0) {
+        delete this;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef INCLUDE_ARENA_H
+#define INCLUDE_ARENA_H
+
+#include <stddef.h>
+
+// Bump allocation for values that are created together and are expected
+// to die together, such as the result of reading a large data file. While
+// an Arena::Scope is open, every RefCounted object created on that thread
+// is carved out of large blocks instead of coming from the heap. Objects
+// are still destroyed one at a time when their count drops to zero, but
+// their memory is only handed back when the last of them has gone, so a
+// single value kept from a read keeps the whole arena alive. That is why
+// arenas are opt-in.
+class Arena {
+public:
+    class Scope {
+    public:
+        // Passing false makes allocations come from the heap, even inside
+        // an enclosing scope. Use this for anything that lives forever.
+        Scope(bool useArena = true);
+        ~Scope();
+
+    private:
+        Scope(const Scope&); // no copy ctor
+        Scope& operator = (const Scope&); // no assignments
+
+        Arena* m_arena;
+        Arena* m_previous;
+    };
+
+    // Returns memory from the current thread's arena, or NULL if there
+    // isn't one or the request is too large to be worth it.
+    static void* allocate(size_t size);
+
+    // Whether p is the most recent allocation from the current thread's
+    // arena, which is how a newly constructed object tells where it lives.
+    // Only answers true once for each allocation.
+    static bool claim(const void* p);
+
+    // Whether p was handed out by the current thread's arena.
+    static bool owns(const void* p);
+
+    // Called once the object at p has been destroyed.
+    static void release(const void* p);
+
+private:
+    struct Block;
+
+    Arena();
+    ~Arena();
+
+    void* allocateFrom(size_t size);
+    void  addBlock();
+    void  unref();
+
+    Block*  m_blocks;
+    char*   m_top;
+    char*   m_limit;
+    size_t  m_liveCount;    // objects, plus one while the scope is open
+};
+
+#endif // INCLUDE_ARENA_H
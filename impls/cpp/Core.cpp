@@ -1,5 +1,11 @@
 #include "MAL.h"
+#include "Arena.h"
+#include "CycleCollector.h"
 #include "Environment.h"
+#include "FormCache.h"
+#include "MappedFile.h"
+#include "Pool.h"
+#include "Reader.h"
 #include "StaticList.h"
 #include "Types.h"
 
@@ -19,12 +25,15 @@
     checkArgsAtLeast(name.c_str(), expected, \
                         std::distance(argsBegin, argsEnd))
 
+static void loadForms(const String& path, FormSource& source,
+                      FormCacheWriter* cache);
 static String printValues(malValueIter begin, malValueIter end,
                            const String& sep, bool readably);
 
 static StaticList<malBuiltIn*> handlers;
 
 #define ARG(type, name) type* name = VALUE_CAST(type, *argsBegin++)
+#define ARG_INTEGER(name) int64_t name = value_integer(*argsBegin++)
 
 #define FUNCNAME(uniq) builtIn ## uniq
 #define HRECNAME(uniq) handler ## uniq
@@ -52,19 +61,18 @@ static StaticList<malBuiltIn*> handlers;
 #define BUILTIN_INTOP(op, checkDivByZero) \
     BUILTIN(#op) { \
         CHECK_ARGS_IS(2); \
-        ARG(malInteger, lhs); \
-        ARG(malInteger, rhs); \
+        ARG_INTEGER(lhs); \
+        ARG_INTEGER(rhs); \
         if (checkDivByZero) { \
-            MAL_CHECK(rhs->value() != 0, "Division by zero"); \
+            MAL_CHECK(rhs != 0, "Division by zero"); \
         } \
-        return mal::integer(lhs->value() op rhs->value()); \
+        return mal::integer(lhs op rhs); \
     }
 
 BUILTIN_ISA("atom?",        malAtom);
 BUILTIN_ISA("keyword?",     malKeyword);
 BUILTIN_ISA("list?",        malList);
 BUILTIN_ISA("map?",         malHash);
-BUILTIN_ISA("number?",      malInteger);
 BUILTIN_ISA("sequential?",  malSequence);
 BUILTIN_ISA("string?",      malString);
 BUILTIN_ISA("symbol?",      malSymbol);
@@ -82,56 +90,56 @@ BUILTIN_IS("nil?",          nilValue);
 BUILTIN("-")
 {
     int argCount = CHECK_ARGS_BETWEEN(1, 2);
-    ARG(malInteger, lhs);
+    ARG_INTEGER(lhs);
     if (argCount == 1) {
-        return mal::integer(- lhs->value());
+        return mal::integer(- lhs);
     }
 
-    ARG(malInteger, rhs);
-    return mal::integer(lhs->value() - rhs->value());
+    ARG_INTEGER(rhs);
+    return mal::integer(lhs - rhs);
 }
 
 BUILTIN("<=")
 {
     CHECK_ARGS_IS(2);
-    ARG(malInteger, lhs);
-    ARG(malInteger, rhs);
+    ARG_INTEGER(lhs);
+    ARG_INTEGER(rhs);
 
-    return mal::boolean(lhs->value() <= rhs->value());
+    return mal::boolean(lhs <= rhs);
 }
 
 BUILTIN(">=")
 {
     CHECK_ARGS_IS(2);
-    ARG(malInteger, lhs);
-    ARG(malInteger, rhs);
+    ARG_INTEGER(lhs);
+    ARG_INTEGER(rhs);
 
-    return mal::boolean(lhs->value() >= rhs->value());
+    return mal::boolean(lhs >= rhs);
 }
 
 BUILTIN("<")
 {
     CHECK_ARGS_IS(2);
-    ARG(malInteger, lhs);
-    ARG(malInteger, rhs);
+    ARG_INTEGER(lhs);
+    ARG_INTEGER(rhs);
 
-    return mal::boolean(lhs->value() < rhs->value());
+    return mal::boolean(lhs < rhs);
 }
 
 BUILTIN(">")
 {
     CHECK_ARGS_IS(2);
-    ARG(malInteger, lhs);
-    ARG(malInteger, rhs);
+    ARG_INTEGER(lhs);
+    ARG_INTEGER(rhs);
 
-    return mal::boolean(lhs->value() > rhs->value());
+    return mal::boolean(lhs > rhs);
 }
 
 BUILTIN("=")
 {
     CHECK_ARGS_IS(2);
-    const malValue* lhs = (*argsBegin++).ptr();
-    const malValue* rhs = (*argsBegin++).ptr();
+    malValuePtr lhs = *argsBegin++;
+    malValuePtr rhs = *argsBegin++;
 
     return mal::boolean(lhs->isEqualTo(rhs));
 }
@@ -143,6 +151,7 @@ BUILTIN("apply")
 
     // Copy the first N-1 arguments in.
     malValueVec args(argsBegin, argsEnd-1);
+    GC_ROOT(args);
 
     // Then append the argument as a list.
     const malSequence* lastArg = VALUE_CAST(malSequence, *(argsEnd-1));
@@ -150,7 +159,7 @@ BUILTIN("apply")
         args.push_back(lastArg->item(i));
     }
 
-    return APPLY(op, args.begin(), args.end());
+    return APPLY(op, args.data(), args.data() + args.size());
 }
 
 BUILTIN("assoc")
@@ -168,6 +177,12 @@ BUILTIN("atom")
     return mal::atom(*argsBegin);
 }
 
+BUILTIN("collect-cycles")
+{
+    CHECK_ARGS_IS(0);
+    return mal::integer(CycleCollector::collect());
+}
+
 BUILTIN("concat")
 {
     int count = 0;
@@ -176,15 +191,15 @@ BUILTIN("concat")
         count += seq->count();
     }
 
-    malValueVec* items = new malValueVec(count);
+    malList* list = malList::create(count);
     int offset = 0;
     for (auto it = argsBegin; it != argsEnd; ++it) {
         const malSequence* seq = STATIC_CAST(malSequence, *it);
-        std::copy(seq->begin(), seq->end(), items->begin() + offset);
+        std::copy(seq->begin(), seq->end(), list->begin() + offset);
         offset += seq->count();
     }
 
-    return mal::list(items);
+    return malValuePtr(list);
 }
 
 BUILTIN("conj")
@@ -201,11 +216,11 @@ BUILTIN("cons")
     malValuePtr first = *argsBegin++;
     ARG(malSequence, rest);
 
-    malValueVec* items = new malValueVec(1 + rest->count());
-    items->at(0) = first;
-    std::copy(rest->begin(), rest->end(), items->begin() + 1);
+    malList* list = malList::create(1 + rest->count());
+    list->begin()[0] = first;
+    std::copy(rest->begin(), rest->end(), list->begin() + 1);
 
-    return mal::list(items);
+    return malValuePtr(list);
 }
 
 BUILTIN("contains?")
@@ -229,6 +244,20 @@ BUILTIN("count")
     return mal::integer(seq->count());
 }
 
+BUILTIN("cycle-stats")
+{
+    CHECK_ARGS_IS(0);
+
+    CycleCollector::Stats stats = CycleCollector::stats();
+    malHash::Map map;
+    map.set(mal::keyword(":collections"), mal::integer(stats.collections));
+    map.set(mal::keyword(":scanned"), mal::integer(stats.scanned));
+    map.set(mal::keyword(":freed"), mal::integer(stats.freed));
+    map.set(mal::keyword(":roots"), mal::integer(stats.roots));
+    map.set(mal::keyword(":threshold"), mal::integer(stats.threshold));
+    return mal::hash(map);
+}
+
 BUILTIN("deref")
 {
     CHECK_ARGS_IS(1);
@@ -282,6 +311,21 @@ BUILTIN("fn?")
     return mal::boolean(DYNAMIC_CAST(malBuiltIn, arg));
 }
 
+#if MAL_TRACING_GC
+BUILTIN("gc-stats")
+{
+    CHECK_ARGS_IS(0);
+
+    Gc::Stats stats = Gc::stats();
+    malHash::Map map;
+    map.set(mal::keyword(":collections"), mal::integer(stats.collections));
+    map.set(mal::keyword(":freed"), mal::integer(stats.freed));
+    map.set(mal::keyword(":live"), mal::integer(stats.live));
+    map.set(mal::keyword(":threshold"), mal::integer(stats.threshold));
+    return mal::hash(map);
+}
+#endif
+
 BUILTIN("get")
 {
     CHECK_ARGS_IS(2);
@@ -320,6 +364,46 @@ BUILTIN("list")
     return mal::list(argsBegin, argsEnd);
 }
 
+// Files smaller than this aren't worth starting threads to read.
+static const size_t parallelLoadSize = 4 * 1024 * 1024;
+
+BUILTIN("load-file")
+{
+    CHECK_ARGS_IS(1);
+    ARG(malString, filename);
+    const String path = filename->value();
+
+    FormCacheReader cached(path);
+    if (cached.isValid()) {
+        loadForms(path, cached, NULL);
+        return mal::nilValue();
+    }
+
+    // Regular files are read straight out of the mapped pages, and large
+    // ones are read on several threads. Anything else is streamed, so that
+    // only the current form is ever buffered.
+    FormCacheWriter cache(path);
+    MappedFile mapped(path);
+    int threadCount = ParallelFormReader::defaultThreadCount();
+    if (mapped.isMapped() && (threadCount > 1)
+                          && (mapped.size() >= parallelLoadSize)) {
+        ParallelFormReader reader(mapped, threadCount);
+        loadForms(path, reader, &cache);
+    }
+    else if (mapped.isMapped()) {
+        FormReader reader(mapped);
+        loadForms(path, reader, &cache);
+    }
+    else {
+        std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+        MAL_CHECK(!file.fail(), "Cannot open %s", path.c_str());
+        FormReader reader(file);
+        loadForms(path, reader, &cache);
+    }
+    cache.commit();
+    return mal::nilValue();
+}
+
 BUILTIN("macro?")
 {
     CHECK_ARGS_IS(1);
@@ -336,13 +420,15 @@ BUILTIN("map")
     ARG(malSequence, source);
 
     const int length = source->count();
-    malValueVec* items = new malValueVec(length);
+    malList* list = malList::create(length);
+    malValuePtr result(list);
+    GC_ROOT(result);
     auto it = source->begin();
     for (int i = 0; i < length; i++) {
-      items->at(i) = APPLY(op, it+i, it+i+1);
+      list->begin()[i] = APPLY(op, it+i, it+i+1);
     }
 
-    return  mal::list(items);
+    return result;
 }
 
 BUILTIN("meta")
@@ -357,12 +443,38 @@ BUILTIN("nth")
 {
     CHECK_ARGS_IS(2);
     ARG(malSequence, seq);
-    ARG(malInteger,  index);
+    ARG_INTEGER(index);
+
+    MAL_CHECK(index >= 0 && index < seq->count(), "Index out of range");
+
+    return seq->item(index);
+}
 
-    int i = index->value();
-    MAL_CHECK(i >= 0 && i < seq->count(), "Index out of range");
+BUILTIN("number?")
+{
+    CHECK_ARGS_IS(1);
+    return mal::boolean((*argsBegin).isInteger());
+}
+
+// One map per size class, for checking how the pools behave under load.
+BUILTIN("pool-stats")
+{
+    CHECK_ARGS_IS(0);
 
-    return seq->item(i);
+    std::vector<Pool::Stats> stats = Pool::stats();
+    malValueVec classes;
+    for (auto it = stats.begin(), end = stats.end(); it != end; ++it) {
+        malHash::Map map;
+        map.set(mal::keyword(":size"), mal::integer(it->objectSize));
+        map.set(mal::keyword(":allocations"), mal::integer(it->allocations));
+        map.set(mal::keyword(":frees"), mal::integer(it->frees));
+        map.set(mal::keyword(":live"),
+                mal::integer(it->allocations - it->frees));
+        map.set(mal::keyword(":blocks"), mal::integer(it->blocks));
+        map.set(mal::keyword(":capacity"), mal::integer(it->capacity));
+        classes.push_back(mal::hash(map));
+    }
+    return mal::list(classes);
 }
 
 BUILTIN("pr-str")
@@ -382,11 +494,20 @@ BUILTIN("prn")
     return mal::nilValue();
 }
 
+// Setting MAL_READ_ARENA makes read-string allocate everything it reads
+// from one arena, which suits large one-shot data loads (see Arena.h).
+static bool useReadArena()
+{
+    static const bool useArena = getenv("MAL_READ_ARENA") != NULL;
+    return useArena;
+}
+
 BUILTIN("read-string")
 {
     CHECK_ARGS_IS(1);
     ARG(malString, str);
 
+    Arena::Scope arena(useReadArena());
     return readStr(str->value());
 }
 
@@ -409,7 +530,7 @@ BUILTIN("rest")
 {
     CHECK_ARGS_IS(1);
     if (*argsBegin == mal::nilValue()) {
-        return mal::list(new malValueVec(0));
+        return malValuePtr(malList::create(0));
     }
     ARG(malSequence, seq);
     return seq->rest();
@@ -432,11 +553,12 @@ BUILTIN("seq")
         if (length == 0)
             return mal::nilValue();
 
-        malValueVec* items = new malValueVec(length);
+        malList* list = malList::create(length);
+        malValuePtr result(list);
         for (int i = 0; i < length; i++) {
-            (*items)[i] = mal::string(str.substr(i, 1));
+            list->begin()[i] = mal::string(str.substr(i, 1));
         }
-        return mal::list(items);
+        return result;
     }
     MAL_FAIL("%s is not a string or sequence", arg->print(true).c_str());
 }
@@ -446,17 +568,23 @@ BUILTIN("slurp")
 {
     CHECK_ARGS_IS(1);
     ARG(malString, filename);
+    const String path = filename->value();
+
+    MappedFile mapped(path);
+    if (mapped.isMapped()) {
+        return mal::string(mapped.begin(), mapped.end());
+    }
 
-    std::ios_base::openmode openmode =
-        std::ios::ate | std::ios::in | std::ios::binary;
-    std::ifstream file(filename->value().c_str(), openmode);
-    MAL_CHECK(!file.fail(), "Cannot open %s", filename->value().c_str());
+    // Pipes and special files can't be mapped, and don't know their size
+    // up front, so read them in chunks.
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    MAL_CHECK(!file.fail(), "Cannot open %s", path.c_str());
 
     String data;
-    data.reserve(file.tellg());
-    file.seekg(0, std::ios::beg);
-    data.append(std::istreambuf_iterator<char>(file.rdbuf()),
-                std::istreambuf_iterator<char>());
+    char chunk[64 * 1024];
+    while (file.read(chunk, sizeof(chunk)) || (file.gcount() > 0)) {
+        data.append(chunk, file.gcount());
+    }
 
     return mal::string(data);
 }
@@ -474,10 +602,11 @@ BUILTIN("swap!")
     malValuePtr op = *argsBegin++; // this gets checked in APPLY
 
     malValueVec args(1 + argsEnd - argsBegin);
+    GC_ROOT(args);
     args[0] = atom->deref();
     std::copy(argsBegin, argsEnd, args.begin() + 1);
 
-    malValuePtr value = APPLY(op, args.begin(), args.end());
+    malValuePtr value = APPLY(op, args.data(), args.data() + args.size());
     return atom->reset(value);
 }
 
@@ -533,6 +662,27 @@ BUILTIN("with-meta")
     return obj->withMeta(meta);
 }
 
+// Evaluates each form as soon as it has been read, rather than reading
+// the whole file into one big (do ...) first.
+static void loadForms(const String& path, FormSource& source,
+                      FormCacheWriter* cache)
+{
+    malValuePtr form;
+    GC_ROOT(form);
+    GC_ROOT(source);
+    try {
+        while (source.next(form)) {
+            if (cache != NULL) {
+                cache->write(form, source.line());
+            }
+            EVAL(form, NULL);
+        }
+    }
+    catch (String& s) {
+        MAL_FAIL("%s:%d: %s", path.c_str(), source.line(), s.c_str());
+    }
+}
+
 void installCore(malEnvPtr env) {
     for (auto it = handlers.begin(), end = handlers.end(); it != end; ++it) {
         malBuiltIn* handler = *it;
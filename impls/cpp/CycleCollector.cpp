@@ -0,0 +1,380 @@
+#include "CycleCollector.h"
+#include "RefCountedPtr.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <vector>
+
+// Black objects are in use, or have not been looked at. Gray ones might be
+// garbage, white ones are, and purple ones are buffered roots.
+enum Color {
+    black,
+    gray,
+    white,
+    purple,
+};
+
+typedef std::vector<const RefCounted*> ObjectVec;
+
+std::atomic<bool> CycleCollector::s_isDue(false);
+
+static const size_t defaultThreshold = 4096;
+
+// 0 turns the automatic collections off.
+static size_t baseThreshold()
+{
+    static const size_t threshold = []() {
+        const char* value = getenv("MAL_CYCLE_THRESHOLD");
+        return (value != NULL) ? strtoul(value, NULL, 10) : defaultThreshold;
+    }();
+    return threshold;
+}
+
+// Dead roots still have to be swept when collections are off, or nothing
+// buffered would ever be freed.
+static size_t sweepInterval()
+{
+    return (baseThreshold() != 0) ? baseThreshold() : defaultThreshold;
+}
+
+struct CollectorState {
+    CollectorState()
+    : isCollecting(false), nextCheck(sweepInterval()), lastLiveScanned(0)
+    , collections(0), scanned(0), freed(0) { }
+
+    ~CollectorState();
+
+    ObjectVec roots;
+    bool      isCollecting;
+    size_t    nextCheck;        // roots.size() that makes a check due
+    size_t    lastLiveScanned;  // objects scanned that weren't garbage
+    uint64_t  collections;
+    uint64_t  scanned;
+    uint64_t  freed;
+};
+
+static thread_local CollectorState t_state;
+
+// Walks the graph from an object with an explicit stack, so that deep
+// structures don't need a deep C stack. For each reference held by an
+// object taken off the stack, step() decides whether to push the target.
+template<class Step>
+class Walker : public ReferenceVisitor {
+public:
+    Walker(Step step) : m_step(step) { }
+
+    void run(const RefCounted* start) {
+        m_stack.push_back(start);
+        while (!m_stack.empty()) {
+            const RefCounted* object = m_stack.back();
+            m_stack.pop_back();
+            object->visitReferences(*this);
+        }
+    }
+
+    virtual void visit(const RefCounted* object) {
+        // Immortal objects are never garbage, and their counts must not
+        // change.
+        if ((object->refCount() >= 0) && m_step(object)) {
+            m_stack.push_back(object);
+        }
+    }
+
+private:
+    Step      m_step;
+    ObjectVec m_stack;
+};
+
+template<class Step>
+static void walk(const RefCounted* start, Step step)
+{
+    Walker<Step>(step).run(start);
+}
+
+class CycleCollectorImpl {
+public:
+    static Color color(const RefCounted* object) {
+        return static_cast<Color>(object->m_gcFlags & RefCounted::gcColorMask);
+    }
+
+    static void setColor(const RefCounted* object, Color color) {
+        object->m_gcFlags =
+            (object->m_gcFlags & ~RefCounted::gcColorMask) | color;
+    }
+
+    static bool isBuffered(const RefCounted* object) {
+        return (object->m_gcFlags & RefCounted::gcBuffered) != 0;
+    }
+
+    static void setBuffered(const RefCounted* object, bool isBuffered) {
+        if (isBuffered) {
+            object->m_gcFlags |= RefCounted::gcBuffered;
+        }
+        else {
+            object->m_gcFlags &= ~RefCounted::gcBuffered;
+        }
+    }
+
+    static void sweepDeadRoots(CollectorState& state);
+    static uint64_t collectCycles(CollectorState& state);
+
+private:
+    static size_t markGray(const RefCounted* root);
+    static void scan(const RefCounted* root);
+    static void scanBlack(const RefCounted* root);
+    static void collectWhite(const RefCounted* root, ObjectVec& garbage);
+    static void freeGarbage(const ObjectVec& garbage);
+};
+
+// A root whose count reached zero while it was buffered was left for us.
+// Destroying one can kill others, or buffer new ones, so keep going round
+// until nothing more dies.
+void CycleCollectorImpl::sweepDeadRoots(CollectorState& state)
+{
+    bool isDestroying = true;
+    while (isDestroying) {
+        isDestroying = false;
+        ObjectVec roots;
+        roots.swap(state.roots);
+        for (auto it = roots.begin(), end = roots.end(); it != end; ++it) {
+            const RefCounted* object = *it;
+            if (object->m_refCount == 0) {
+                setBuffered(object, false);
+                setColor(object, black);
+                object->destroy();
+                isDestroying = true;
+            }
+            else {
+                state.roots.push_back(object);
+            }
+        }
+    }
+}
+
+// Takes away the counts due to references from the root's subgraph.
+// Returns the number of objects newly marked.
+size_t CycleCollectorImpl::markGray(const RefCounted* root)
+{
+    if (color(root) == gray) {
+        return 0;
+    }
+    size_t marked = 1;
+    setColor(root, gray);
+    walk(root, [&marked](const RefCounted* object) {
+        object->m_refCount--;
+        if (color(object) == gray) {
+            return false;
+        }
+        setColor(object, gray);
+        marked++;
+        return true;
+    });
+    return marked;
+}
+
+// Whatever is still counted is referenced from outside the subgraph, and
+// so is everything it reaches. The rest is garbage.
+void CycleCollectorImpl::scan(const RefCounted* root)
+{
+    ObjectVec stack(1, root);
+    while (!stack.empty()) {
+        const RefCounted* object = stack.back();
+        stack.pop_back();
+        if (color(object) != gray) {
+            continue;
+        }
+        if (object->m_refCount > 0) {
+            scanBlack(object);
+        }
+        else {
+            setColor(object, white);
+            walk(object, [&stack](const RefCounted* child) {
+                if (color(child) == gray) {
+                    stack.push_back(child);
+                }
+                return false;
+            });
+        }
+    }
+}
+
+// Puts back the counts markGray took away.
+void CycleCollectorImpl::scanBlack(const RefCounted* root)
+{
+    setColor(root, black);
+    walk(root, [](const RefCounted* object) {
+        object->m_refCount++;
+        if (color(object) == black) {
+            return false;
+        }
+        setColor(object, black);
+        return true;
+    });
+}
+
+void CycleCollectorImpl::collectWhite(const RefCounted* root,
+                                      ObjectVec& garbage)
+{
+    if ((color(root) != white) || isBuffered(root)) {
+        return;
+    }
+    setColor(root, black);
+    garbage.push_back(root);
+    walk(root, [&garbage](const RefCounted* object) {
+        if ((color(object) != white) || isBuffered(object)) {
+            return false;
+        }
+        setColor(object, black);
+        garbage.push_back(object);
+        return true;
+    });
+}
+
+// The counts of references from garbage were never put back, so do that
+// first. Then, while holding every garbage object alive, break the cycles
+// by clearing the atoms and environments among them. Letting go leaves
+// ordinary refcounting to free the lot.
+void CycleCollectorImpl::freeGarbage(const ObjectVec& garbage)
+{
+    class Restore : public ReferenceVisitor {
+    public:
+        virtual void visit(const RefCounted* object) {
+            if (object->refCount() >= 0) {
+                object->m_refCount++;
+            }
+        }
+    } restore;
+
+    for (auto it = garbage.begin(), end = garbage.end(); it != end; ++it) {
+        (*it)->visitReferences(restore);
+    }
+    for (auto it = garbage.begin(), end = garbage.end(); it != end; ++it) {
+        (*it)->acquire();
+    }
+    for (auto it = garbage.begin(), end = garbage.end(); it != end; ++it) {
+        const_cast<RefCounted*>(*it)->dropReferences();
+    }
+    for (auto it = garbage.begin(), end = garbage.end(); it != end; ++it) {
+        if ((*it)->release() == 0) {
+            (*it)->destroy();
+        }
+    }
+}
+
+uint64_t CycleCollectorImpl::collectCycles(CollectorState& state)
+{
+    sweepDeadRoots(state);
+
+    ObjectVec roots;
+    roots.swap(state.roots);
+
+    // A root that an earlier root's subgraph has already reached is dealt
+    // with as part of that subgraph.
+    size_t scanned = 0;
+    size_t kept = 0;
+    for (auto it = roots.begin(), end = roots.end(); it != end; ++it) {
+        if (color(*it) == purple) {
+            scanned += markGray(*it);
+            roots[kept++] = *it;
+        }
+        else {
+            setBuffered(*it, false);
+        }
+    }
+    roots.resize(kept);
+
+    for (auto it = roots.begin(), end = roots.end(); it != end; ++it) {
+        scan(*it);
+    }
+
+    ObjectVec garbage;
+    for (auto it = roots.begin(), end = roots.end(); it != end; ++it) {
+        setBuffered(*it, false);
+        collectWhite(*it, garbage);
+    }
+    freeGarbage(garbage);
+
+    // Freeing the garbage can buffer parts of it on the way.
+    sweepDeadRoots(state);
+
+    state.collections++;
+    state.scanned += scanned;
+    state.freed += garbage.size();
+    state.lastLiveScanned = scanned - garbage.size();
+    return garbage.size();
+}
+
+CollectorState::~CollectorState()
+{
+    // Roots left at thread exit are no longer watched, but the dead ones
+    // still have to be destroyed.
+    isCollecting = true;
+    CycleCollectorImpl::sweepDeadRoots(*this);
+    for (auto it = roots.begin(), end = roots.end(); it != end; ++it) {
+        CycleCollectorImpl::setBuffered(*it, false);
+        CycleCollectorImpl::setColor(*it, black);
+    }
+    roots.clear();
+}
+
+void CycleCollector::addRoot(const RefCounted* object)
+{
+    CollectorState& state = t_state;
+    CycleCollectorImpl::setColor(object, purple);
+    CycleCollectorImpl::setBuffered(object, true);
+    state.roots.push_back(object);
+    if ((state.roots.size() == state.nextCheck) && !state.isCollecting) {
+        s_isDue.store(true, std::memory_order_relaxed);
+    }
+}
+
+uint64_t CycleCollector::collect()
+{
+    CollectorState& state = t_state;
+    if (state.isCollecting) {
+        return 0;
+    }
+    state.isCollecting = true;
+    uint64_t freed = CycleCollectorImpl::collectCycles(state);
+    state.isCollecting = false;
+    state.nextCheck = state.roots.size() + sweepInterval();
+    return freed;
+}
+
+// Dead roots are cheap to deal with, so they are swept every time the
+// buffer grows by the base threshold, which bounds the memory they hold.
+// Trial deletion costs time in proportion to the graph it scans, so it
+// only runs once the live roots outnumber the objects the last collection
+// scanned and had to keep, and never when the threshold is 0.
+void CycleCollector::collectIfDue()
+{
+    CollectorState& state = t_state;
+    if (state.isCollecting || (state.roots.size() < state.nextCheck)) {
+        return;
+    }
+    s_isDue.store(false, std::memory_order_relaxed);
+
+    state.isCollecting = true;
+    CycleCollectorImpl::sweepDeadRoots(state);
+    state.isCollecting = false;
+
+    if ((baseThreshold() != 0) && (state.roots.size()
+            >= std::max(baseThreshold(), state.lastLiveScanned))) {
+        collect();
+    }
+    else {
+        state.nextCheck = state.roots.size() + sweepInterval();
+    }
+}
+
+CycleCollector::Stats CycleCollector::stats()
+{
+    const CollectorState& state = t_state;
+    Stats stats;
+    stats.collections = state.collections;
+    stats.scanned     = state.scanned;
+    stats.freed       = state.freed;
+    stats.roots       = state.roots.size();
+    stats.threshold   = std::max(baseThreshold(), state.lastLiveScanned);
+    return stats;
+}
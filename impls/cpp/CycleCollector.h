@@ -0,0 +1,68 @@
+#ifndef INCLUDE_CYCLECOLLECTOR_H
+#define INCLUDE_CYCLECOLLECTOR_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+class RefCounted;
+
+// Called with each object that another object holds a reference to.
+class ReferenceVisitor {
+public:
+    virtual void visit(const RefCounted* object) = 0;
+};
+
+// Refcounting alone never frees a cycle, such as an atom holding a closure
+// whose environment holds the atom. This finds such cycles by trial
+// deletion (Bacon and Rajan's synchronous algorithm).
+//
+// Values are immutable apart from atoms, environments and the spare
+// slots that conj fills in a vector's storage, so every cycle runs
+// through one of those. Only they and closures are candidates: when the
+// count of one drops without reaching zero, it is buffered as a possible
+// root of a garbage cycle. A collection removes the references among
+// everything reachable from the roots, and whatever ends up with no count
+// left is only referenced from inside the cycle. Those cycles are broken
+// by clearing their atoms, environments and storage, and are then freed
+// as normal.
+//
+// A candidate whose count reaches zero while it is buffered is only
+// destroyed by the next collection. Collections run on the next
+// allocation once the thread has buffered MAL_CYCLE_THRESHOLD roots
+// (4096 by default, and 0 turns them off). The threshold grows with the
+// size of the object graph the previous collection had to scan.
+class CycleCollector {
+public:
+    struct Stats {
+        uint64_t collections;
+        uint64_t scanned;       // objects visited by trial deletion
+        uint64_t freed;         // objects found in garbage cycles
+        size_t   roots;         // currently buffered
+        size_t   threshold;
+    };
+
+    // Collects the calling thread's buffered roots, and returns the number
+    // of objects found in garbage cycles.
+    static uint64_t collect();
+
+    // Totals for the calling thread.
+    static Stats stats();
+
+    // Called on each allocation.
+    static void poll() {
+        if (s_isDue.load(std::memory_order_relaxed)) {
+            collectIfDue();
+        }
+    }
+
+private:
+    friend class RefCounted;
+
+    static void addRoot(const RefCounted* object);
+    static void collectIfDue();
+
+    static std::atomic<bool> s_isDue;
+};
+
+#endif // INCLUDE_CYCLECOLLECTOR_H
@@ -0,0 +1,95 @@
+#include "DestroyQueue.h"
+#include "RefCountedPtr.h"
+
+#include <stdlib.h>
+
+static size_t budgetFromEnvironment()
+{
+    const char* budget = getenv("MAL_FREE_BUDGET");
+    return (budget != NULL) ? strtoul(budget, NULL, 10) : 0;
+}
+
+// Zero until static initialisation has run, so that objects freed before
+// then are destroyed straight away.
+size_t DestroyQueue::s_budget = budgetFromEnvironment();
+
+// Plain data, so that it needs no guard on each access.
+struct PendingList {
+    const RefCounted** objects;
+    size_t             count;
+    size_t             capacity;
+    bool               isDestroying;
+};
+
+static thread_local PendingList t_pending;
+
+// Doesn't leave the thread's dead objects behind when it exits.
+class ThreadExit {
+public:
+    ~ThreadExit() {
+        DestroyQueue::flush();
+        free(t_pending.objects);
+        t_pending.objects = NULL;
+        t_pending.capacity = 0;
+    }
+};
+
+static thread_local ThreadExit t_exit;
+
+// Returns false if there was no memory to grow the list.
+static bool append(PendingList& pending, const RefCounted* object)
+{
+    if (pending.count == pending.capacity) {
+        (void)&t_exit; // make sure the list will be flushed
+        size_t capacity = (pending.capacity == 0) ? 256 : 2 * pending.capacity;
+        void* objects = realloc(pending.objects,
+                                capacity * sizeof(*pending.objects));
+        if (objects == NULL) {
+            return false;
+        }
+        pending.objects = static_cast<const RefCounted**>(objects);
+        pending.capacity = capacity;
+    }
+    pending.objects[pending.count++] = object;
+    return true;
+}
+
+void DestroyQueue::push(const RefCounted* object)
+{
+    PendingList& pending = t_pending;
+    if ((s_budget != 0) || pending.isDestroying) {
+        // This is called from destructors, so it mustn't throw. Without
+        // the memory to queue the object, destroy it here instead.
+        if (!append(pending, object)) {
+            object->destroyNow();
+        }
+        return;
+    }
+
+    // Most objects have no children that die with them, so the first one
+    // never needs to go on the list.
+    pending.isDestroying = true;
+    object->destroyNow();
+    while (pending.count > 0) {
+        pending.objects[--pending.count]->destroyNow();
+    }
+    pending.isDestroying = false;
+}
+
+void DestroyQueue::flush()
+{
+    destroySome(static_cast<size_t>(-1));
+}
+
+void DestroyQueue::destroySome(size_t count)
+{
+    PendingList& pending = t_pending;
+    if (pending.isDestroying) {
+        return;
+    }
+    pending.isDestroying = true;
+    for ( ; (count > 0) && (pending.count > 0); count--) {
+        pending.objects[--pending.count]->destroyNow();
+    }
+    pending.isDestroying = false;
+}
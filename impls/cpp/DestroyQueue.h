@@ -0,0 +1,40 @@
+#ifndef INCLUDE_DESTROYQUEUE_H
+#define INCLUDE_DESTROYQUEUE_H
+
+#include <stddef.h>
+
+class RefCounted;
+
+// Objects whose count has dropped to zero are destroyed from a per-thread
+// work list rather than straight away. Destroying an object releases its
+// children, and any of those that die too join the list instead of being
+// destroyed further down the stack, so freeing a structure of any depth
+// uses a bounded amount of stack.
+//
+// Normally the list is emptied before the release that started it
+// returns. Setting MAL_FREE_BUDGET to a number of objects leaves dead
+// objects on the list instead, and each allocation then destroys up to
+// that many of them, which spreads the cost of dropping a large structure
+// over the work that follows.
+class DestroyQueue {
+public:
+    // Called when the object's count drops to zero.
+    static void push(const RefCounted* object);
+
+    // Called on each allocation.
+    static void payDebt() {
+        if (s_budget != 0) {
+            destroySome(s_budget);
+        }
+    }
+
+    // Destroys everything on the calling thread's list.
+    static void flush();
+
+private:
+    static void destroySome(size_t count);
+
+    static size_t s_budget;
+};
+
+#endif // INCLUDE_DESTROYQUEUE_H
@@ -2,29 +2,33 @@
 #include "Types.h"
 
 #include <algorithm>
+#include <utility>
 
 malEnv::malEnv(malEnvPtr outer)
-: m_outer(outer)
+: m_outer(std::move(outer))
 {
     TRACE_ENV("Creating malEnv %p, outer=%p\n", this, m_outer.ptr());
+    makeCycleCandidate();
 }
 
-malEnv::malEnv(malEnvPtr outer, const StringVec& bindings,
+malEnv::malEnv(malEnvPtr outer, const malSymbolIdVec& bindings,
                malValueIter argsBegin, malValueIter argsEnd)
-: m_outer(outer)
+: m_outer(std::move(outer))
 {
     TRACE_ENV("Creating malEnv %p, outer=%p\n", this, m_outer.ptr());
+    makeCycleCandidate();
+    static const int ampersand = malSymbol::intern("&")->id();
     int n = bindings.size();
     auto it = argsBegin;
     for (int i = 0; i < n; i++) {
-        if (bindings[i] == "&") {
+        if (bindings[i] == ampersand) {
             MAL_CHECK(i == n - 2, "There must be one parameter after the &");
 
-            set(bindings[n-1], mal::list(it, argsEnd));
+            m_map[bindings[n-1]] = mal::list(it, argsEnd);
             return;
         }
         MAL_CHECK(it != argsEnd, "Not enough parameters");
-        set(bindings[i], *it);
+        m_map[bindings[i]] = *it;
         ++it;
     }
     MAL_CHECK(it == argsEnd, "Too many parameters");
@@ -35,39 +39,62 @@ malEnv::~malEnv()
     TRACE_ENV("Destroying malEnv %p, outer=%p\n", this, m_outer.ptr());
 }
 
-malEnvPtr malEnv::find(const String& symbol)
+malEnvPtr malEnv::find(const malSymbol* symbol)
 {
-    for (malEnvPtr env = this; env; env = env->m_outer) {
-        if (env->m_map.find(symbol) != env->m_map.end()) {
+    // Each environment keeps its outer one alive, so the chain can be
+    // walked without taking references.
+    const int id = symbol->id();
+    for (malEnv* env = this; env; env = env->m_outer.ptr()) {
+        if (env->m_map.find(id) != env->m_map.end()) {
             return env;
         }
     }
     return NULL;
 }
 
-malValuePtr malEnv::get(const String& symbol)
+malValuePtr malEnv::get(const malSymbol* symbol)
 {
-    for (malEnvPtr env = this; env; env = env->m_outer) {
-        auto it = env->m_map.find(symbol);
+    const int id = symbol->id();
+    for (malEnv* env = this; env; env = env->m_outer.ptr()) {
+        auto it = env->m_map.find(id);
         if (it != env->m_map.end()) {
             return it->second;
         }
     }
-    MAL_FAIL("'%s' not found", symbol.c_str());
+    MAL_FAIL("'%s' not found", symbol->value().c_str());
 }
 
-malValuePtr malEnv::set(const String& symbol, malValuePtr value)
+malValuePtr malEnv::set(const malSymbol* symbol, malValuePtr value)
 {
-    m_map[symbol] = value;
+    m_map[symbol->id()] = value;
     return value;
 }
 
+malValuePtr malEnv::set(const String& symbol, malValuePtr value)
+{
+    return set(malSymbol::intern(symbol), value);
+}
+
 malEnvPtr malEnv::getRoot()
 {
     // Work our way down the the global environment.
-    for (malEnvPtr env = this; ; env = env->m_outer) {
+    for (malEnv* env = this; ; env = env->m_outer.ptr()) {
         if (!env->m_outer) {
             return env;
         }
     }
 }
+
+void malEnv::visitReferences(ReferenceVisitor& visitor) const
+{
+    for (auto it = m_map.begin(), end = m_map.end(); it != end; ++it) {
+        it->second.visit(visitor);
+    }
+    m_outer.visit(visitor);
+}
+
+void malEnv::dropReferences()
+{
+    m_map.clear();
+    m_outer = NULL;
+}
@@ -5,23 +5,30 @@
 
 #include <map>
 
+class malSymbol;
+
 class malEnv : public RefCounted {
 public:
     malEnv(malEnvPtr outer = NULL);
     malEnv(malEnvPtr outer,
-           const StringVec& bindings,
+           const malSymbolIdVec& bindings,
            malValueIter argsBegin,
            malValueIter argsEnd);
 
     ~malEnv();
 
-    malValuePtr get(const String& symbol);
-    malEnvPtr   find(const String& symbol);
+    malValuePtr get(const malSymbol* symbol);
+    malEnvPtr   find(const malSymbol* symbol);
+    malValuePtr set(const malSymbol* symbol, malValuePtr value);
     malValuePtr set(const String& symbol, malValuePtr value);
     malEnvPtr   getRoot();
 
+    virtual void visitReferences(ReferenceVisitor& visitor) const;
+    virtual void dropReferences();
+
 private:
-    typedef std::map<String, malValuePtr> Map;
+    // Keyed by interned symbol id.
+    typedef std::map<int, malValuePtr> Map;
     Map m_map;
     malEnvPtr m_outer;
 };
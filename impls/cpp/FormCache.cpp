@@ -0,0 +1,366 @@
+#include "FormCache.h"
+#include "Types.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bump this whenever the layout below changes.
+static const char     cacheMagic[4] = { 'M', 'A', 'L', 'C' };
+static const uint64_t cacheVersion  = 1;
+
+// An entry is the magic, then a header of varints
+//     version, source size, mtime seconds, mtime nanoseconds,
+//     canonical source path (length and bytes),
+// followed by a FORM record (tag, line, value) per top-level form and
+// a closing END tag. A file without the END tag was never committed.
+enum {
+    TAG_END,
+    TAG_FORM,
+    TAG_NIL,
+    TAG_TRUE,
+    TAG_FALSE,
+    TAG_INTEGER,
+    TAG_STRING,
+    TAG_SYMBOL,
+    TAG_KEYWORD,
+    TAG_LIST,
+    TAG_VECTOR,
+    TAG_HASH,
+};
+
+struct SourceStamp {
+    String   path;
+    uint64_t size;
+    uint64_t mtimeSec;
+    uint64_t mtimeNsec;
+};
+
+// Fills in the stamp for a cacheable source file, and returns the path of
+// its cache entry, or an empty string if the file can't be cached.
+static String cachePathFor(const String& sourcePath, SourceStamp& stamp)
+{
+    const char* cacheDir = getenv("MAL_FORM_CACHE");
+    if ((cacheDir == NULL) || (*cacheDir == '\0')) {
+        return String();
+    }
+
+    char* canonical = realpath(sourcePath.c_str(), NULL);
+    if (canonical == NULL) {
+        return String();
+    }
+    stamp.path = copyAndFree(canonical);
+
+    struct stat info;
+    if ((stat(stamp.path.c_str(), &info) != 0) || !S_ISREG(info.st_mode)) {
+        return String();
+    }
+    stamp.size = info.st_size;
+#ifdef __APPLE__
+    stamp.mtimeSec  = info.st_mtimespec.tv_sec;
+    stamp.mtimeNsec = info.st_mtimespec.tv_nsec;
+#else
+    stamp.mtimeSec  = info.st_mtim.tv_sec;
+    stamp.mtimeNsec = info.st_mtim.tv_nsec;
+#endif
+
+    // Name the entry after an FNV-1a hash of the canonical path. The path
+    // itself is kept in the header to rule out collisions.
+    uint64_t hash = 14695981039346656037ULL;
+    for (auto c : stamp.path) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+    }
+    return STRF("%s/%016llx.malc", cacheDir, (unsigned long long)hash);
+}
+
+static void writeValue(String& out, malValuePtr value);
+
+static void writeVarint(String& out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+static void writeBytes(String& out, const String& bytes)
+{
+    writeVarint(out, bytes.size());
+    out += bytes;
+}
+
+static void writeSequence(String& out, int tag, const malSequence* seq)
+{
+    out += static_cast<char>(tag);
+    writeVarint(out, seq->count());
+    for (auto it = seq->begin(), end = seq->end(); it != end; ++it) {
+        writeValue(out, *it);
+    }
+}
+
+// Only the types the reader can produce need to be handled.
+static void writeValue(String& out, malValuePtr value)
+{
+    if (value == mal::nilValue()) {
+        out += static_cast<char>(TAG_NIL);
+    }
+    else if (value == mal::trueValue()) {
+        out += static_cast<char>(TAG_TRUE);
+    }
+    else if (value == mal::falseValue()) {
+        out += static_cast<char>(TAG_FALSE);
+    }
+    else if (value.isInteger()) {
+        // Zigzag encoding keeps small negative numbers small.
+        uint64_t n = value.integerValue();
+        out += static_cast<char>(TAG_INTEGER);
+        writeVarint(out, (n << 1) ^ -(n >> 63));
+    }
+    else if (const malString* s = DYNAMIC_CAST(malString, value)) {
+        out += static_cast<char>(TAG_STRING);
+        writeBytes(out, s->value());
+    }
+    else if (const malSymbol* s = DYNAMIC_CAST(malSymbol, value)) {
+        out += static_cast<char>(TAG_SYMBOL);
+        writeBytes(out, s->value());
+    }
+    else if (const malKeyword* k = DYNAMIC_CAST(malKeyword, value)) {
+        out += static_cast<char>(TAG_KEYWORD);
+        writeBytes(out, k->value());
+    }
+    else if (const malList* list = DYNAMIC_CAST(malList, value)) {
+        writeSequence(out, TAG_LIST, list);
+    }
+    else if (const malVector* vector = DYNAMIC_CAST(malVector, value)) {
+        writeSequence(out, TAG_VECTOR, vector);
+    }
+    else if (const malHash* hash = DYNAMIC_CAST(malHash, value)) {
+        malValuePtr keys = hash->keys();
+        malValuePtr values = hash->values();
+        const malSequence* k = STATIC_CAST(malSequence, keys);
+        const malSequence* v = STATIC_CAST(malSequence, values);
+        out += static_cast<char>(TAG_HASH);
+        writeVarint(out, k->count());
+        for (int i = 0; i < k->count(); i++) {
+            writeValue(out, k->item(i));
+            writeValue(out, v->item(i));
+        }
+    }
+    else {
+        MAL_FAIL("Cannot cache %s", value->print(true).c_str());
+    }
+}
+
+class CacheCursor {
+public:
+    CacheCursor(const char*& pos, const char* end)
+        : m_pos(pos), m_end(end) { }
+
+    int tag() {
+        check(1);
+        return static_cast<unsigned char>(*m_pos++);
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; ; shift += 7) {
+            check(1);
+            MAL_CHECK(shift < 64, "Corrupt form cache");
+            unsigned char byte = *m_pos++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+    }
+
+    String bytes() {
+        uint64_t length = varint();
+        check(length);
+        String s(m_pos, length);
+        m_pos += length;
+        return s;
+    }
+
+    malValuePtr value();
+
+private:
+    malValuePtr collection(int tag);
+
+    void check(uint64_t length) {
+        MAL_CHECK(length <= static_cast<uint64_t>(m_end - m_pos),
+                  "Corrupt form cache");
+    }
+
+    const char*& m_pos;
+    const char*  m_end;
+};
+
+malValuePtr CacheCursor::value()
+{
+    int tag = this->tag();
+    switch (tag) {
+        case TAG_NIL:       return mal::nilValue();
+        case TAG_TRUE:      return mal::trueValue();
+        case TAG_FALSE:     return mal::falseValue();
+        case TAG_INTEGER: {
+            uint64_t n = varint();
+            return mal::integer(static_cast<int64_t>((n >> 1) ^ -(n & 1)));
+        }
+        case TAG_STRING:    return mal::string(bytes());
+        case TAG_SYMBOL:    return mal::symbol(bytes());
+        case TAG_KEYWORD:   return mal::keyword(bytes());
+        case TAG_LIST:
+        case TAG_VECTOR:
+        case TAG_HASH:      return collection(tag);
+    }
+    MAL_FAIL("Corrupt form cache");
+}
+
+malValuePtr CacheCursor::collection(int tag)
+{
+    uint64_t count = varint();
+    if (tag == TAG_HASH) {
+        count *= 2;
+    }
+    // Every item takes at least one byte, so this also stops a corrupt
+    // count from reserving a huge vector.
+    check(count);
+
+    if (tag == TAG_HASH) {
+        malValueVec items;
+        items.reserve(count);
+        for (uint64_t i = 0; i < count; i++) {
+            items.push_back(value());
+        }
+        return mal::hash(items.data(), items.data() + items.size(), false);
+    }
+
+    malSequence* seq = (tag == TAG_LIST)
+        ? static_cast<malSequence*>(malList::create(count))
+        : static_cast<malSequence*>(malVector::create(count));
+    malValuePtr result(seq);
+    for (malValueIter it = seq->begin(), end = seq->end(); it != end; ++it) {
+        *it = value();
+    }
+    return result;
+}
+
+FormCacheReader::FormCacheReader(const String& sourcePath)
+: m_pos(NULL)
+, m_end(NULL)
+, m_line(0)
+{
+    SourceStamp stamp;
+    String cachePath = cachePathFor(sourcePath, stamp);
+    if (cachePath.empty() || (access(cachePath.c_str(), R_OK) != 0)) {
+        return;
+    }
+
+    std::unique_ptr<MappedFile> cache(new MappedFile(cachePath));
+    const char* pos = cache->begin();
+    const char* end = cache->end();
+    if (!cache->isMapped() || (cache->size() < sizeof(cacheMagic) + 1)
+        || (memcmp(pos, cacheMagic, sizeof(cacheMagic)) != 0)
+        || (end[-1] != TAG_END)) {
+        return;
+    }
+    pos += sizeof(cacheMagic);
+
+    try {
+        CacheCursor cursor(pos, end);
+        if ((cursor.varint() != cacheVersion)
+            || (cursor.varint() != stamp.size)
+            || (cursor.varint() != stamp.mtimeSec)
+            || (cursor.varint() != stamp.mtimeNsec)
+            || (cursor.bytes() != stamp.path)) {
+            return;
+        }
+    }
+    catch (String&) {
+        return;
+    }
+
+    m_cache.reset(cache.release());
+    m_pos = pos;
+    m_end = end;
+}
+
+bool FormCacheReader::next(malValuePtr& form)
+{
+    CacheCursor cursor(m_pos, m_end);
+    if (cursor.tag() == TAG_END) {
+        return false;
+    }
+    m_line = cursor.varint();
+    form = cursor.value();
+    return true;
+}
+
+FormCacheWriter::FormCacheWriter(const String& sourcePath)
+: m_isEnabled(false)
+{
+    SourceStamp stamp;
+    m_cachePath = cachePathFor(sourcePath, stamp);
+    if (m_cachePath.empty()) {
+        return;
+    }
+
+    // Write to a private file, and only rename it into place once it is
+    // complete, so that readers never see a partial entry.
+    m_tempPath = STRF("%s.%d.tmp", m_cachePath.c_str(), (int)getpid());
+    m_out.open(m_tempPath.c_str(), std::ios::out | std::ios::binary
+                                                 | std::ios::trunc);
+    if (m_out.fail()) {
+        return;
+    }
+    m_isEnabled = true;
+
+    String header(cacheMagic, sizeof(cacheMagic));
+    writeVarint(header, cacheVersion);
+    writeVarint(header, stamp.size);
+    writeVarint(header, stamp.mtimeSec);
+    writeVarint(header, stamp.mtimeNsec);
+    writeBytes(header, stamp.path);
+    m_out.write(header.data(), header.size());
+}
+
+FormCacheWriter::~FormCacheWriter()
+{
+    if (m_isEnabled) {
+        // Never committed, so throw the partial entry away.
+        m_out.close();
+        unlink(m_tempPath.c_str());
+    }
+}
+
+void FormCacheWriter::write(malValuePtr form, int line)
+{
+    if (m_isEnabled) {
+        // Each record is built up in memory and written in one go.
+        m_record.clear();
+        m_record += static_cast<char>(TAG_FORM);
+        writeVarint(m_record, line);
+        writeValue(m_record, form);
+        m_out.write(m_record.data(), m_record.size());
+    }
+}
+
+void FormCacheWriter::commit()
+{
+    if (!m_isEnabled) {
+        return;
+    }
+    m_isEnabled = false;
+
+    m_out.put(TAG_END);
+    m_out.close();
+    if (m_out.fail()
+        || (rename(m_tempPath.c_str(), m_cachePath.c_str()) != 0)) {
+        unlink(m_tempPath.c_str());
+    }
+}
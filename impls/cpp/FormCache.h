@@ -0,0 +1,54 @@
+#ifndef INCLUDE_FORMCACHE_H
+#define INCLUDE_FORMCACHE_H
+
+#include "MAL.h"
+#include "MappedFile.h"
+#include "Reader.h"
+
+#include <fstream>
+#include <memory>
+
+// load-file can keep the forms it reads from a source file in a compact
+// binary cache, so that loading the file again while it is unchanged
+// skips the reader entirely. Caching is off unless the MAL_FORM_CACHE
+// environment variable names a directory to keep the cache files in.
+// Entries are keyed by the file's canonical path, and are only valid
+// while the file's size and modification time match.
+
+// Reads the forms back out of a valid cache entry.
+class FormCacheReader : public FormSource {
+public:
+    FormCacheReader(const String& sourcePath);
+
+    bool isValid() const { return m_cache.get() != NULL; }
+
+    virtual bool next(malValuePtr& form);
+    virtual int line() const { return m_line; }
+
+private:
+    std::unique_ptr<MappedFile> m_cache;
+    const char* m_pos;
+    const char* m_end;
+    int         m_line;
+};
+
+// Records the forms read from a source file. The entry only replaces
+// the existing one when commit() is called after the whole file has
+// been read.
+class FormCacheWriter {
+public:
+    FormCacheWriter(const String& sourcePath);
+    ~FormCacheWriter();
+
+    void write(malValuePtr form, int line);
+    void commit();
+
+private:
+    String          m_cachePath;
+    String          m_tempPath;
+    String          m_record;
+    std::ofstream   m_out;
+    bool            m_isEnabled;
+};
+
+#endif // INCLUDE_FORMCACHE_H
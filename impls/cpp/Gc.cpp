@@ -0,0 +1,200 @@
+#include "Gc.h"
+
+#if MAL_TRACING_GC
+
+#include "RefCountedPtr.h"
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <stdlib.h>
+#include <vector>
+
+typedef std::vector<const RefCounted*> ObjectVec;
+
+std::atomic<bool> Gc::s_isDue(false);
+
+thread_local GcRoot* GcRoot::s_top = NULL;
+
+static size_t baseThreshold()
+{
+    static const size_t threshold = []() {
+        const char* value = getenv("MAL_GC_THRESHOLD");
+        return (value != NULL) ? strtoul(value, NULL, 10) : 16384;
+    }();
+    return threshold;
+}
+
+// Plain data, so that it needs no guard on each access.
+struct Heap {
+    const RefCounted** objects;
+    size_t             count;
+    size_t             capacity;
+    size_t             dueAt;       // count that makes a collection due
+};
+
+static thread_local Heap t_heap;
+
+// Objects tracked by threads that have since exited, such as the parallel
+// reader's. The next collection takes them over. Guarded by s_lock.
+static std::mutex s_lock;
+static ObjectVec  s_orphans;
+
+// Whatever thread collects sets these.
+static uint64_t s_collections = 0;
+static uint64_t s_freed = 0;
+static size_t   s_live = 0;
+
+class ThreadExit {
+public:
+    ~ThreadExit() {
+        std::lock_guard<std::mutex> lock(s_lock);
+        s_orphans.insert(s_orphans.end(),
+                         t_heap.objects, t_heap.objects + t_heap.count);
+        free(t_heap.objects);
+        t_heap.objects = NULL;
+        t_heap.count = 0;
+        t_heap.capacity = 0;
+    }
+};
+
+static thread_local ThreadExit t_exit;
+
+class GcImpl {
+public:
+    static bool isMarked(const RefCounted* object) {
+        return (object->m_gcFlags & RefCounted::gcMarked) != 0;
+    }
+
+    static void setMarked(const RefCounted* object, bool isMarked) {
+        if (isMarked) {
+            object->m_gcFlags |= RefCounted::gcMarked;
+        }
+        else {
+            object->m_gcFlags &= ~RefCounted::gcMarked;
+        }
+    }
+
+    static bool isImmortal(const RefCounted* object) {
+        return object->m_refCount == RefCounted::immortalCount;
+    }
+
+    static void destroy(const RefCounted* object) {
+        object->destroyNow();
+    }
+};
+
+// Marks everything reachable from the roots, with an explicit stack so
+// that deep structures don't need a deep C stack. Immortal objects are
+// never freed, and can be shared with other threads, so they are left
+// alone.
+class Marker : public ReferenceVisitor {
+public:
+    void run() {
+        while (!m_stack.empty()) {
+            const RefCounted* object = m_stack.back();
+            m_stack.pop_back();
+            object->visitReferences(*this);
+        }
+    }
+
+    virtual void visit(const RefCounted* object) {
+        if (!GcImpl::isImmortal(object) && !GcImpl::isMarked(object)) {
+            GcImpl::setMarked(object, true);
+            m_stack.push_back(object);
+        }
+    }
+
+private:
+    ObjectVec m_stack;
+};
+
+void Gc::track(const RefCounted* object)
+{
+    Heap& heap = t_heap;
+    if (heap.count == heap.capacity) {
+        if (heap.capacity == 0) {
+            (void)&t_exit; // make sure the objects are handed on at exit
+            heap.dueAt = baseThreshold();
+        }
+        size_t capacity = (heap.capacity == 0) ? 1024 : 2 * heap.capacity;
+        void* objects = realloc(heap.objects, capacity * sizeof(*heap.objects));
+        if (objects == NULL) {
+            throw std::bad_alloc();
+        }
+        heap.objects = static_cast<const RefCounted**>(objects);
+        heap.capacity = capacity;
+    }
+    heap.objects[heap.count++] = object;
+    if (heap.count == heap.dueAt) {
+        s_isDue.store(true, std::memory_order_relaxed);
+    }
+}
+
+void Gc::collect()
+{
+    s_isDue.store(false, std::memory_order_relaxed);
+    Heap& heap = t_heap;
+    {
+        std::lock_guard<std::mutex> lock(s_lock);
+        for (auto it = s_orphans.begin(), end = s_orphans.end();
+                it != end; ++it) {
+            track(*it);
+        }
+        s_orphans.clear();
+    }
+
+    Marker marker;
+    for (const GcRoot* root = GcRoot::s_top; root != NULL;
+            root = root->m_next) {
+        root->visitRoots(marker);
+    }
+    marker.run();
+
+    // The heap is settled before anything is destroyed, so that nothing a
+    // destructor does can disturb the sweep. Objects made immortal since
+    // they were tracked are never freed, so they are dropped from it.
+    ObjectVec dead;
+    size_t kept = 0;
+    for (size_t i = 0; i < heap.count; i++) {
+        const RefCounted* object = heap.objects[i];
+        if (GcImpl::isMarked(object)) {
+            GcImpl::setMarked(object, false);
+            heap.objects[kept++] = object;
+        }
+        else if (!GcImpl::isImmortal(object)) {
+            dead.push_back(object);
+        }
+    }
+    heap.count = kept;
+    for (auto it = dead.begin(), end = dead.end(); it != end; ++it) {
+        GcImpl::destroy(*it);
+    }
+
+    // Collecting again once the heap has doubled keeps the cost of marking
+    // in proportion to the allocation.
+    if (baseThreshold() != 0) {
+        heap.dueAt = std::max(2 * kept, baseThreshold());
+    }
+    s_collections++;
+    s_freed += dead.size();
+    s_live = kept;
+    s_isDue.store(false, std::memory_order_relaxed);
+}
+
+Gc::Stats Gc::stats()
+{
+    Stats stats;
+    stats.collections = s_collections;
+    stats.freed       = s_freed;
+    stats.live        = s_live;
+    stats.threshold   = t_heap.dueAt;
+    return stats;
+}
+
+void GcRootedObject::visitRoots(ReferenceVisitor& visitor) const
+{
+    visitor.visit(m_object);
+}
+
+#endif // MAL_TRACING_GC
@@ -0,0 +1,116 @@
+#ifndef INCLUDE_GC_H
+#define INCLUDE_GC_H
+
+// Building with MAL_TRACING_GC set (make GC=1) replaces reference counting
+// with a precise mark-sweep collector. Copying a pointer then never writes
+// to the object, and cycles are freed like anything else. The price is
+// that every value the C++ code holds across a collection has to be
+// registered as a root.
+//
+// Collections only happen at safe points, which EVAL passes on each turn
+// of its loop, so only values held across a call to EVAL or APPLY need to
+// be rooted: EVAL's own locals, the builtins that call back into mal, and
+// the global environment. Objects are tracked from the first time they are
+// held by a malValuePtr or RefCountedPtr, and those that aren't reachable
+// from a root at a safe point are freed.
+
+#if MAL_TRACING_GC
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+class RefCounted;
+class ReferenceVisitor;
+
+class Gc {
+public:
+    // Called the first time an object is held by a pointer.
+    static void track(const RefCounted* object);
+
+    static void safePoint() {
+        if (s_isDue.load(std::memory_order_relaxed)) {
+            collect();
+        }
+    }
+
+    // Only safe where safePoint() would be.
+    static void collect();
+
+    struct Stats {
+        uint64_t collections;
+        uint64_t freed;
+        size_t   live;          // tracked objects after the last collection
+        size_t   threshold;
+    };
+
+    static Stats stats();
+
+private:
+    static std::atomic<bool> s_isDue;
+};
+
+// Registers something that holds values for as long as it is in scope. The
+// roots on a thread form a stack, so they must be destroyed in reverse
+// order, which locals and statics are.
+class GcRoot {
+public:
+    GcRoot() : m_next(s_top) { s_top = this; }
+    virtual ~GcRoot() { s_top = m_next; }
+
+    virtual void visitRoots(ReferenceVisitor& visitor) const = 0;
+
+private:
+    friend class Gc;
+
+    GcRoot(const GcRoot&); // no copy ctor
+    GcRoot& operator = (const GcRoot&); // no assignments
+
+    GcRoot* m_next;
+    static thread_local GcRoot* s_top;
+};
+
+// Roots a variable, whatever it holds at the time of a collection. There
+// has to be a gcVisit(const T&, ReferenceVisitor&) for its type.
+template<class T>
+class GcRooted : public GcRoot {
+public:
+    GcRooted(const T& slot) : m_slot(slot) { }
+
+    virtual void visitRoots(ReferenceVisitor& visitor) const {
+        gcVisit(m_slot, visitor);
+    }
+
+private:
+    const T& m_slot;
+};
+
+// Roots one object, such as this.
+class GcRootedObject : public GcRoot {
+public:
+    GcRootedObject(const RefCounted* object) : m_object(object) { }
+
+    virtual void visitRoots(ReferenceVisitor& visitor) const;
+
+private:
+    const RefCounted* m_object;
+};
+
+#define GC_CONCAT(a, b)         a##b
+#define GC_ROOT_NAME(line)      GC_CONCAT(gcRoot, line)
+
+#define GC_ROOT(slot) \
+    GcRooted<decltype(slot)> GC_ROOT_NAME(__LINE__)(slot)
+#define GC_ROOT_OBJECT(object) \
+    GcRootedObject GC_ROOT_NAME(__LINE__)(object)
+#define GC_SAFE_POINT()         Gc::safePoint()
+
+#else
+
+#define GC_ROOT(slot)
+#define GC_ROOT_OBJECT(object)
+#define GC_SAFE_POINT()
+
+#endif // MAL_TRACING_GC
+
+#endif // INCLUDE_GC_H
@@ -0,0 +1,406 @@
+#include "HashTrie.h"
+
+#include <new>
+#include <utility>
+
+static const int bitsPerLevel = 5;
+static const int hashBits     = 32;
+
+// Up to this many entries are kept in a flat root node rather than a trie.
+static const int maxFlatCount = 8;
+
+// Most keys are interned keywords, which are equal only when identical.
+static bool isSameKey(const malValuePtr& a, const malValuePtr& b)
+{
+    return (a == b) || a.isEqualTo(b);
+}
+
+static uint32_t bitFor(uint32_t hash, int shift)
+{
+    return 1u << ((hash >> shift) & 31);
+}
+
+// Entries and children are stored in the order of their bits, so the
+// index of one is the number of bits set below it.
+static int indexOf(uint32_t map, uint32_t bit)
+{
+    return __builtin_popcount(map & (bit - 1));
+}
+
+class HashTrieImpl {
+public:
+    typedef HashTrieNode::Entry Entry;
+
+    static const malValuePtr* find(const HashTrieNode* node,
+                                   const malValuePtr& key, uint32_t hash);
+    static HashTrieNodePtr set(const HashTrieNode* node, const Entry& entry,
+                               uint32_t hash, int shift, bool& isAdded);
+    static HashTrieNodePtr erase(const HashTrieNode* node,
+                                 const malValuePtr& key, uint32_t hash,
+                                 int shift, bool& isErased);
+    static HashTrieNodePtr flat(const Entry& entry);
+    static HashTrieNodePtr promote(const HashTrieNode* node,
+                                   const Entry& entry);
+
+    // A flat root has the same layout as a collision node, which is
+    // searched in order without needing the hash.
+    static bool isCollision(const HashTrieNode* node) {
+        return (node->m_dataMap == 0) && (node->m_nodeMap == 0);
+    }
+
+private:
+
+    static bool isSingleEntry(const HashTrieNode* node) {
+        return (node->m_dataCount == 1) && (node->m_nodeCount == 0);
+    }
+
+    static HashTrieNodePtr self(const HashTrieNode* node) {
+        return HashTrieNodePtr(const_cast<HashTrieNode*>(node));
+    }
+
+    static HashTrieNodePtr reshape(const HashTrieNode* node,
+                                   uint32_t dataMap, uint32_t nodeMap,
+                                   int dropData, int gapData,
+                                   int dropNode, int gapNode);
+    static HashTrieNodePtr pair(const Entry& a, uint32_t hashA,
+                                const Entry& b, uint32_t hashB, int shift);
+};
+
+const malValuePtr* HashTrieImpl::find(const HashTrieNode* node,
+                                      const malValuePtr& key, uint32_t hash)
+{
+    for (int shift = 0; ; shift += bitsPerLevel) {
+        if (isCollision(node)) {
+            const Entry* entries = node->entries();
+            for (int i = 0; i < node->m_dataCount; i++) {
+                if (isSameKey(entries[i].key, key)) {
+                    return &entries[i].value;
+                }
+            }
+            return NULL;
+        }
+        uint32_t bit = bitFor(hash, shift);
+        if (node->m_dataMap & bit) {
+            const Entry& entry = node->entries()[indexOf(node->m_dataMap, bit)];
+            return isSameKey(entry.key, key) ? &entry.value : NULL;
+        }
+        if ((node->m_nodeMap & bit) == 0) {
+            return NULL;
+        }
+        node = node->children()[indexOf(node->m_nodeMap, bit)].ptr();
+    }
+}
+
+// Copies the node into one with the given maps. The entry at dropData and
+// the child at dropNode are left out, and the slots at gapData and gapNode
+// in the copy are left empty for the caller to fill. Any of them can be
+// -1 for none.
+HashTrieNodePtr HashTrieImpl::reshape(const HashTrieNode* node,
+                                      uint32_t dataMap, uint32_t nodeMap,
+                                      int dropData, int gapData,
+                                      int dropNode, int gapNode)
+{
+    int dataCount = node->m_dataCount - (dropData >= 0) + (gapData >= 0);
+    int nodeCount = node->m_nodeCount - (dropNode >= 0) + (gapNode >= 0);
+    HashTrieNodePtr copy(
+        HashTrieNode::create(dataMap, nodeMap, dataCount, nodeCount));
+
+    const Entry* entry = node->entries();
+    for (int i = 0; i < dataCount; i++) {
+        if (i == gapData) {
+            continue;
+        }
+        if (entry - node->entries() == dropData) {
+            ++entry;
+        }
+        copy->entries()[i] = *entry++;
+    }
+
+    const HashTrieNodePtr* child = node->children();
+    for (int i = 0; i < nodeCount; i++) {
+        if (i == gapNode) {
+            continue;
+        }
+        if (child - node->children() == dropNode) {
+            ++child;
+        }
+        copy->children()[i] = *child++;
+    }
+    return copy;
+}
+
+// A node holding two entries that collided in their parent.
+HashTrieNodePtr HashTrieImpl::pair(const Entry& a, uint32_t hashA,
+                                   const Entry& b, uint32_t hashB, int shift)
+{
+    if (shift >= hashBits) {
+        HashTrieNodePtr node(HashTrieNode::create(0, 0, 2, 0));
+        node->entries()[0] = a;
+        node->entries()[1] = b;
+        return node;
+    }
+    uint32_t bitA = bitFor(hashA, shift);
+    uint32_t bitB = bitFor(hashB, shift);
+    if (bitA == bitB) {
+        HashTrieNodePtr node(HashTrieNode::create(0, bitA, 0, 1));
+        node->children()[0] = pair(a, hashA, b, hashB, shift + bitsPerLevel);
+        return node;
+    }
+    HashTrieNodePtr node(HashTrieNode::create(bitA | bitB, 0, 2, 0));
+    node->entries()[bitA < bitB ? 0 : 1] = a;
+    node->entries()[bitA < bitB ? 1 : 0] = b;
+    return node;
+}
+
+HashTrieNodePtr HashTrieImpl::flat(const Entry& entry)
+{
+    HashTrieNodePtr node(HashTrieNode::create(0, 0, 1, 0));
+    node->entries()[0] = entry;
+    return node;
+}
+
+// Moves the entries of a full flat root, and a new one, into a trie.
+HashTrieNodePtr HashTrieImpl::promote(const HashTrieNode* node,
+                                      const Entry& entry)
+{
+    const Entry& first = node->entries()[0];
+    uint32_t hash = first.key->hash();
+    HashTrieNodePtr root(HashTrieNode::create(bitFor(hash, 0), 0, 1, 0));
+    root->entries()[0] = first;
+
+    bool isAdded;
+    for (int i = 1; i < node->m_dataCount; i++) {
+        const Entry& next = node->entries()[i];
+        root = set(root.ptr(), next, next.key->hash(), 0, isAdded);
+    }
+    return set(root.ptr(), entry, entry.key->hash(), 0, isAdded);
+}
+
+HashTrieNodePtr HashTrieImpl::set(const HashTrieNode* node, const Entry& entry,
+                                  uint32_t hash, int shift, bool& isAdded)
+{
+    const uint32_t dataMap = node->m_dataMap;
+    const uint32_t nodeMap = node->m_nodeMap;
+
+    if (isCollision(node)) {
+        for (int i = 0; i < node->m_dataCount; i++) {
+            if (isSameKey(node->entries()[i].key, entry.key)) {
+                if (node->entries()[i].value == entry.value) {
+                    return self(node);
+                }
+                HashTrieNodePtr copy = reshape(node, 0, 0, -1, -1, -1, -1);
+                copy->entries()[i].value = entry.value;
+                return copy;
+            }
+        }
+        int index = node->m_dataCount;
+        HashTrieNodePtr copy = reshape(node, 0, 0, -1, index, -1, -1);
+        copy->entries()[index] = entry;
+        isAdded = true;
+        return copy;
+    }
+
+    uint32_t bit = bitFor(hash, shift);
+    if (dataMap & bit) {
+        int index = indexOf(dataMap, bit);
+        const Entry& existing = node->entries()[index];
+        if (isSameKey(existing.key, entry.key)) {
+            if (existing.value == entry.value) {
+                return self(node);
+            }
+            HashTrieNodePtr copy = reshape(node, dataMap, nodeMap,
+                                           -1, -1, -1, -1);
+            copy->entries()[index].value = entry.value;
+            return copy;
+        }
+        // Both entries move down into a new child.
+        int nodeIndex = indexOf(nodeMap, bit);
+        HashTrieNodePtr child = pair(existing, existing.key->hash(),
+                                     entry, hash, shift + bitsPerLevel);
+        HashTrieNodePtr copy = reshape(node, dataMap ^ bit, nodeMap | bit,
+                                       index, -1, -1, nodeIndex);
+        copy->children()[nodeIndex] = std::move(child);
+        isAdded = true;
+        return copy;
+    }
+    if (nodeMap & bit) {
+        int index = indexOf(nodeMap, bit);
+        const HashTrieNodePtr& child = node->children()[index];
+        HashTrieNodePtr updated = set(child.ptr(), entry, hash,
+                                      shift + bitsPerLevel, isAdded);
+        if (updated == child) {
+            return self(node);
+        }
+        HashTrieNodePtr copy = reshape(node, dataMap, nodeMap, -1, -1, -1, -1);
+        copy->children()[index] = std::move(updated);
+        return copy;
+    }
+    int index = indexOf(dataMap, bit);
+    HashTrieNodePtr copy = reshape(node, dataMap | bit, nodeMap,
+                                   -1, index, -1, -1);
+    copy->entries()[index] = entry;
+    isAdded = true;
+    return copy;
+}
+
+// Returns NULL once the node has nothing left in it. A child left with a
+// single entry is folded into its parent, so the shape stays the same as
+// if the key had never been added.
+HashTrieNodePtr HashTrieImpl::erase(const HashTrieNode* node,
+                                    const malValuePtr& key, uint32_t hash,
+                                    int shift, bool& isErased)
+{
+    const uint32_t dataMap = node->m_dataMap;
+    const uint32_t nodeMap = node->m_nodeMap;
+
+    if (isCollision(node)) {
+        for (int i = 0; i < node->m_dataCount; i++) {
+            if (isSameKey(node->entries()[i].key, key)) {
+                isErased = true;
+                return reshape(node, 0, 0, i, -1, -1, -1);
+            }
+        }
+        return self(node);
+    }
+
+    uint32_t bit = bitFor(hash, shift);
+    if (dataMap & bit) {
+        int index = indexOf(dataMap, bit);
+        if (!isSameKey(node->entries()[index].key, key)) {
+            return self(node);
+        }
+        isErased = true;
+        if (isSingleEntry(node)) {
+            return HashTrieNodePtr();
+        }
+        return reshape(node, dataMap ^ bit, nodeMap, index, -1, -1, -1);
+    }
+    if (nodeMap & bit) {
+        int index = indexOf(nodeMap, bit);
+        HashTrieNodePtr updated = erase(node->children()[index].ptr(), key,
+                                        hash, shift + bitsPerLevel, isErased);
+        if (!isErased) {
+            return self(node);
+        }
+        if (isSingleEntry(updated.ptr())) {
+            int dataIndex = indexOf(dataMap, bit);
+            HashTrieNodePtr copy = reshape(node, dataMap | bit, nodeMap ^ bit,
+                                           -1, dataIndex, index, -1);
+            copy->entries()[dataIndex] = updated->entries()[0];
+            return copy;
+        }
+        HashTrieNodePtr copy = reshape(node, dataMap, nodeMap, -1, -1, -1, -1);
+        copy->children()[index] = std::move(updated);
+        return copy;
+    }
+    return self(node);
+}
+
+HashTrieNode* HashTrieNode::create(uint32_t dataMap, uint32_t nodeMap,
+                                   int dataCount, int nodeCount)
+{
+    void* memory = allocate(allocationSize(dataCount, nodeCount));
+    return ::new (memory) HashTrieNode(dataMap, nodeMap, dataCount, nodeCount);
+}
+
+HashTrieNode::HashTrieNode(uint32_t dataMap, uint32_t nodeMap,
+                           int dataCount, int nodeCount)
+: m_dataMap(dataMap)
+, m_nodeMap(nodeMap)
+, m_dataCount(dataCount)
+, m_nodeCount(nodeCount)
+{
+    for (Entry* it = entries(), *end = it + dataCount; it != end; ++it) {
+        ::new (it) Entry();
+    }
+    for (HashTrieNodePtr* it = children(), *end = it + nodeCount;
+            it != end; ++it) {
+        ::new (it) HashTrieNodePtr();
+    }
+}
+
+HashTrieNode::~HashTrieNode()
+{
+    for (Entry* it = entries(), *end = it + m_dataCount; it != end; ++it) {
+        it->~Entry();
+    }
+    for (HashTrieNodePtr* it = children(), *end = it + m_nodeCount;
+            it != end; ++it) {
+        it->~HashTrieNodePtr();
+    }
+}
+
+void HashTrieNode::dispose() const
+{
+    // As for malSequence, the size depends on the counts, so the memory
+    // has to be freed here.
+    size_t size = allocationSize(m_dataCount, m_nodeCount);
+    void* memory = const_cast<HashTrieNode*>(this);
+    this->~HashTrieNode();
+    deallocate(memory, size);
+}
+
+void HashTrieNode::visitReferences(ReferenceVisitor& visitor) const
+{
+    for (const Entry* it = entries(), *end = it + m_dataCount;
+            it != end; ++it) {
+        it->key.visit(visitor);
+        it->value.visit(visitor);
+    }
+    for (const HashTrieNodePtr* it = children(), *end = it + m_nodeCount;
+            it != end; ++it) {
+        it->visit(visitor);
+    }
+}
+
+// The hash is only worked out once the map has outgrown a flat root.
+
+const malValuePtr* HashTrie::find(const malValuePtr& key) const
+{
+    if (!m_root) {
+        return NULL;
+    }
+    const HashTrieNode* root = m_root.ptr();
+    uint32_t hash = HashTrieImpl::isCollision(root) ? 0 : key->hash();
+    return HashTrieImpl::find(root, key, hash);
+}
+
+void HashTrie::set(const malValuePtr& key, malValuePtr value)
+{
+    HashTrieNode::Entry entry = { key, std::move(value) };
+    if (!m_root) {
+        m_root = HashTrieImpl::flat(entry);
+        m_count = 1;
+        return;
+    }
+    const HashTrieNode* root = m_root.ptr();
+    bool isAdded = false;
+    if (!HashTrieImpl::isCollision(root)) {
+        m_root = HashTrieImpl::set(root, entry, key->hash(), 0, isAdded);
+    }
+    else if ((m_count < maxFlatCount) || (find(key) != NULL)) {
+        m_root = HashTrieImpl::set(root, entry, 0, 0, isAdded);
+    }
+    else {
+        m_root = HashTrieImpl::promote(root, entry);
+        isAdded = true;
+    }
+    if (isAdded) {
+        m_count++;
+    }
+}
+
+bool HashTrie::erase(const malValuePtr& key)
+{
+    if (!m_root) {
+        return false;
+    }
+    const HashTrieNode* root = m_root.ptr();
+    uint32_t hash = HashTrieImpl::isCollision(root) ? 0 : key->hash();
+    bool isErased = false;
+    m_root = HashTrieImpl::erase(root, key, hash, 0, isErased);
+    if (isErased && (--m_count == 0)) {
+        m_root = HashTrieNodePtr();
+    }
+    return isErased;
+}
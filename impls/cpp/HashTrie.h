@@ -0,0 +1,123 @@
+#ifndef INCLUDE_HASHTRIE_H
+#define INCLUDE_HASHTRIE_H
+
+#include "MAL.h"
+
+#include <stdint.h>
+
+class HashTrieNode;
+typedef RefCountedPtr<HashTrieNode> HashTrieNodePtr;
+
+// A persistent map between values, stored as a hash array mapped trie.
+// Keys are compared with isEqualTo(), so they can be any value. Each node
+// covers five bits of the key's hash, and holds its entries and its
+// children in two arrays ordered by those bits, so a lookup is a handful
+// of bit operations per level. Changing a map copies only the nodes on
+// the path to the key, and the rest are shared with the original, so a
+// trie is cheap to copy and to update.
+//
+// Most maps are small, so up to eight entries are kept in a single flat
+// node instead, in the order they were added, and searched in turn
+// without hashing the key. The ninth moves them all into a trie.
+//
+// The shape of a trie depends only on its keys: a child always holds at
+// least two entries, and one that would be left with fewer is folded back
+// into its parent. Iterating over a trie is in hash order, but a flat
+// node is in the order its keys were added, and a trie that shrinks
+// stays a trie, so two equal maps can iterate in different orders.
+// Nothing may depend on the order: equality looks keys up, and hashing
+// a map sums its entries.
+class HashTrie {
+public:
+    HashTrie() : m_count(0) { }
+
+    int size() const { return m_count; }
+    bool isEmpty() const { return m_count == 0; }
+
+    // Returns NULL if the key isn't there.
+    const malValuePtr* find(const malValuePtr& key) const;
+
+    // These replace the trie with an updated one.
+    void set(const malValuePtr& key, malValuePtr value);
+    bool erase(const malValuePtr& key);
+
+    // Calls f(key, value) for each entry.
+    template<class F>
+    void forEach(F f) const;
+
+    void visit(ReferenceVisitor& visitor) const;
+
+private:
+    HashTrieNodePtr m_root;
+    int             m_count;
+};
+
+class HashTrieNode : public RefCounted {
+public:
+    struct Entry {
+        malValuePtr key;
+        malValuePtr value;
+    };
+
+    template<class F>
+    void forEach(F& f) const {
+        for (const Entry* it = entries(), *end = it + m_dataCount;
+                it != end; ++it) {
+            f(it->key, it->value);
+        }
+        for (const HashTrieNodePtr* it = children(), *end = it + m_nodeCount;
+                it != end; ++it) {
+            (*it)->forEach(f);
+        }
+    }
+
+    virtual void visitReferences(ReferenceVisitor& visitor) const;
+
+private:
+    friend class HashTrieImpl;
+
+    // Entries and children are default constructed, to be filled in
+    // before the node is used. The constructor can't throw.
+    static HashTrieNode* create(uint32_t dataMap, uint32_t nodeMap,
+                                int dataCount, int nodeCount);
+
+    HashTrieNode(uint32_t dataMap, uint32_t nodeMap,
+                 int dataCount, int nodeCount);
+    virtual ~HashTrieNode();
+
+    virtual void dispose() const;
+
+    static size_t allocationSize(int dataCount, int nodeCount) {
+        return sizeof(HashTrieNode) + dataCount * sizeof(Entry)
+                                    + nodeCount * sizeof(HashTrieNodePtr);
+    }
+
+    Entry* entries() const {
+        return reinterpret_cast<Entry*>(const_cast<HashTrieNode*>(this) + 1);
+    }
+    HashTrieNodePtr* children() const {
+        return reinterpret_cast<HashTrieNodePtr*>(entries() + m_dataCount);
+    }
+
+    // Keys whose hashes are equal all the way down share a collision
+    // node, which has neither map set and is searched in order.
+    const uint32_t m_dataMap;
+    const uint32_t m_nodeMap;
+    const int      m_dataCount;
+    const int      m_nodeCount;
+};
+
+inline void HashTrie::visit(ReferenceVisitor& visitor) const
+{
+    m_root.visit(visitor);
+}
+
+template<class F>
+void HashTrie::forEach(F f) const
+{
+    if (m_root) {
+        m_root->forEach(f);
+    }
+}
+
+#endif // INCLUDE_HASHTRIE_H
@@ -5,21 +5,28 @@
 #include "RefCountedPtr.h"
 #include "String.h"
 #include "Validation.h"
+#include "ValuePtr.h"
 
 #include <vector>
 
-class malValue;
-typedef RefCountedPtr<malValue>  malValuePtr;
 typedef std::vector<malValuePtr> malValueVec;
-typedef malValueVec::iterator    malValueIter;
+typedef malValuePtr*             malValueIter;
 
-class malEnv;
-typedef RefCountedPtr<malEnv>     malEnvPtr;
+typedef std::vector<int>         malSymbolIdVec;
+
+#if MAL_TRACING_GC
+inline void gcVisit(const malValueVec& slot, ReferenceVisitor& visitor)
+{
+    for (auto it = slot.begin(), end = slot.end(); it != end; ++it) {
+        it->visit(visitor);
+    }
+}
+#endif
 
 // step*.cpp
-extern malValuePtr APPLY(malValuePtr op,
+extern malValuePtr APPLY(malValueRef op,
                          malValueIter argsBegin, malValueIter argsEnd);
-extern malValuePtr EVAL(malValuePtr ast, malEnvPtr env);
+extern malValuePtr EVAL(malValueRef ast, malEnvRef env);
 extern malValuePtr readline(const String& prompt);
 extern String rep(const String& input, malEnvPtr env);
 
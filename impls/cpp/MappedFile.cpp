@@ -0,0 +1,57 @@
+#include "MappedFile.h"
+#include "Validation.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Pages are handed back in batches, to keep the number of madvise() calls
+// down when reading lots of small forms.
+static const size_t discardBatchSize = 1024 * 1024;
+
+MappedFile::MappedFile(const String& path)
+: m_data("")
+, m_size(0)
+, m_discarded(0)
+, m_isMapped(false)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    MAL_CHECK(fd >= 0, "Cannot open %s", path.c_str());
+
+    // Files that report no size, such as those in /proc, may still have
+    // contents, so they are left for the caller to read as a stream. So
+    // are empty files, as mmap() refuses zero-length mappings.
+    struct stat info;
+    if ((fstat(fd, &info) == 0) && S_ISREG(info.st_mode)
+            && (info.st_size > 0)) {
+        void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            // The reader makes a single pass through the file.
+            madvise(data, info.st_size, MADV_SEQUENTIAL);
+            m_data = static_cast<const char*>(data);
+            m_size = info.st_size;
+            m_isMapped = true;
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_size > 0) {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+}
+
+void MappedFile::discardBefore(const char* pos)
+{
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+
+    size_t offset = (pos - m_data) & ~(pageSize - 1);
+    if (offset >= m_discarded + discardBatchSize) {
+        madvise(const_cast<char*>(m_data) + m_discarded,
+                offset - m_discarded, MADV_DONTNEED);
+        m_discarded = offset;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef INCLUDE_MAPPEDFILE_H
+#define INCLUDE_MAPPEDFILE_H
+
+#include "String.h"
+
+#include <stddef.h>
+
+// Read-only view of a file's contents via mmap. Only regular files with a
+// size can be mapped; for pipes, special files, empty files and those in
+// /proc isMapped() is false and the caller has to fall back to reading
+// the file as a stream.
+class MappedFile {
+public:
+    MappedFile(const String& path);
+    ~MappedFile();
+
+    bool isMapped() const { return m_isMapped; }
+
+    const char* begin() const { return m_data; }
+    const char* end()   const { return m_data + m_size; }
+    size_t      size()  const { return m_size; }
+
+    // Tells the kernel that everything before pos has been consumed, so
+    // its pages can be dropped rather than staying resident.
+    void discardBefore(const char* pos);
+
+private:
+    MappedFile(const MappedFile&); // no copy ctor
+    MappedFile& operator = (const MappedFile&); // no assignments
+
+    const char* m_data;
+    size_t      m_size;
+    size_t      m_discarded;
+    bool        m_isMapped;
+};
+
+#endif // INCLUDE_MAPPEDFILE_H
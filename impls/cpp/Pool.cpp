@@ -0,0 +1,265 @@
+#include "Pool.h"
+
+#include <mutex>
+#include <new>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+// Blocks are aligned to their size, so the block a slot belongs to can be
+// found by masking the slot's address.
+static const size_t blockSize   = 64 * 1024;
+static const size_t granularity = 8;
+static const size_t classCount  = 16;  // maxObjectSize / granularity
+
+// A thread only tries to trim a class once it holds at least this many
+// blocks' worth of free slots.
+static const size_t minTrimBlocks = 4;
+
+struct FreeSlot {
+    FreeSlot* next;
+};
+
+struct Block {
+    Block*   next;
+    size_t   sizeClass;
+    size_t   trimEpoch;
+    size_t   freeSlots;     // only valid during a trim
+};
+
+static const size_t headerSize =
+    (sizeof(Block) + granularity - 1) & ~(granularity - 1);
+
+// Everything shared between threads, guarded by s_lock.
+struct SizeClass {
+    Block*    blocks;
+    FreeSlot* orphans;      // left behind by threads that have exited
+    uint64_t  allocations;  // by threads that have exited
+    uint64_t  frees;
+    size_t    blockCount;
+};
+
+static std::mutex s_lock;
+static SizeClass  s_classes[classCount];
+static size_t     s_trimEpoch = 0;
+
+// Plain data, so that it needs no guard on each access.
+struct ThreadCache {
+    FreeSlot* free[classCount];
+    size_t    freeCount[classCount];
+    size_t    trimAt[classCount];
+    char*     top[classCount];
+    char*     limit[classCount];
+    uint64_t  allocations[classCount];
+    uint64_t  frees[classCount];
+};
+
+static thread_local ThreadCache t_cache;
+
+static size_t objectSize(size_t sizeClass)
+{
+    return (sizeClass + 1) * granularity;
+}
+
+static size_t slotsPerBlock(size_t sizeClass)
+{
+    return (blockSize - headerSize) / objectSize(sizeClass);
+}
+
+static Block* blockOf(const void* p)
+{
+    return reinterpret_cast<Block*>(
+        reinterpret_cast<uintptr_t>(p) & ~(blockSize - 1));
+}
+
+static bool useTrim()
+{
+    static const bool trim = getenv("MAL_POOL_TRIM") != NULL;
+    return trim;
+}
+
+// Blocks are mapped directly, rather than coming from malloc, so that
+// unmapping one really does give the memory back.
+static Block* mapBlock()
+{
+    void* memory = mmap(NULL, 2 * blockSize, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    char* start   = static_cast<char*>(memory);
+    char* aligned = reinterpret_cast<char*>(
+        (reinterpret_cast<uintptr_t>(start) + blockSize - 1)
+            & ~(blockSize - 1));
+    if (aligned != start) {
+        munmap(start, aligned - start);
+    }
+    munmap(aligned + blockSize, start + blockSize - aligned);
+    return reinterpret_cast<Block*>(aligned);
+}
+
+// Hands the thread's free slots, and the rest of its current blocks, over
+// to the shared lists when the thread exits.
+class ThreadExit {
+public:
+    ~ThreadExit() {
+        std::lock_guard<std::mutex> lock(s_lock);
+        for (size_t c = 0; c < classCount; c++) {
+            SizeClass& shared = s_classes[c];
+            size_t size = objectSize(c);
+            for ( ; t_cache.top[c] + size <= t_cache.limit[c];
+                    t_cache.top[c] += size) {
+                FreeSlot* slot = reinterpret_cast<FreeSlot*>(t_cache.top[c]);
+                slot->next = t_cache.free[c];
+                t_cache.free[c] = slot;
+            }
+            while (FreeSlot* slot = t_cache.free[c]) {
+                t_cache.free[c] = slot->next;
+                slot->next = shared.orphans;
+                shared.orphans = slot;
+            }
+            shared.allocations += t_cache.allocations[c];
+            shared.frees       += t_cache.frees[c];
+            t_cache.freeCount[c]   = 0;
+            t_cache.allocations[c] = 0;
+            t_cache.frees[c]       = 0;
+        }
+    }
+};
+
+static thread_local ThreadExit t_exit;
+
+// Called when the thread has no free slot and no room left in its block.
+static void refill(size_t sizeClass)
+{
+    (void)&t_exit; // make sure the thread will flush its cache
+
+    std::lock_guard<std::mutex> lock(s_lock);
+    SizeClass& shared = s_classes[sizeClass];
+    if (shared.orphans != NULL) {
+        size_t count = 0;
+        for (FreeSlot* slot = shared.orphans; slot != NULL; slot = slot->next) {
+            count++;
+        }
+        t_cache.free[sizeClass] = shared.orphans;
+        t_cache.freeCount[sizeClass] = count;
+        shared.orphans = NULL;
+        return;
+    }
+
+    Block* block = mapBlock();
+    block->next = shared.blocks;
+    block->sizeClass = sizeClass;
+    block->trimEpoch = 0;
+    shared.blocks = block;
+    shared.blockCount++;
+
+    t_cache.top[sizeClass]   = reinterpret_cast<char*>(block) + headerSize;
+    t_cache.limit[sizeClass] = reinterpret_cast<char*>(block) + blockSize;
+}
+
+// Unmaps every block whose slots are all on the thread's free list.
+static void trimClass(size_t sizeClass)
+{
+    const size_t capacity = slotsPerBlock(sizeClass);
+    std::lock_guard<std::mutex> lock(s_lock);
+    size_t epoch = ++s_trimEpoch;
+
+    FreeSlot* list = t_cache.free[sizeClass];
+    for (FreeSlot* slot = list; slot != NULL; slot = slot->next) {
+        Block* block = blockOf(slot);
+        if (block->trimEpoch != epoch) {
+            block->trimEpoch = epoch;
+            block->freeSlots = 0;
+        }
+        block->freeSlots++;
+    }
+
+    FreeSlot*  kept = NULL;
+    size_t     keptCount = 0;
+    while (list != NULL) {
+        FreeSlot* slot = list;
+        list = slot->next;
+        if (blockOf(slot)->freeSlots != capacity) {
+            slot->next = kept;
+            kept = slot;
+            keptCount++;
+        }
+    }
+    t_cache.free[sizeClass] = kept;
+    t_cache.freeCount[sizeClass] = keptCount;
+
+    SizeClass& shared = s_classes[sizeClass];
+    Block** link = &shared.blocks;
+    while (Block* block = *link) {
+        if ((block->trimEpoch == epoch) && (block->freeSlots == capacity)) {
+            *link = block->next;
+            shared.blockCount--;
+            munmap(block, blockSize);
+        }
+        else {
+            link = &block->next;
+        }
+    }
+
+    size_t minimum = minTrimBlocks * capacity;
+    t_cache.trimAt[sizeClass] =
+        (2 * keptCount > minimum) ? 2 * keptCount : minimum;
+}
+
+void* Pool::allocate(size_t size)
+{
+    if (size > maxObjectSize) {
+        return NULL;
+    }
+    size_t c = (size - 1) / granularity;
+    ThreadCache& cache = t_cache;
+    cache.allocations[c]++;
+
+    if (FreeSlot* slot = cache.free[c]) {
+        cache.free[c] = slot->next;
+        cache.freeCount[c]--;
+        return slot;
+    }
+    if (cache.top[c] + objectSize(c) > cache.limit[c]) {
+        refill(c);
+        if (FreeSlot* slot = cache.free[c]) {
+            cache.free[c] = slot->next;
+            cache.freeCount[c]--;
+            return slot;
+        }
+    }
+    void* p = cache.top[c];
+    cache.top[c] += objectSize(c);
+    return p;
+}
+
+void Pool::free(void* p, size_t size)
+{
+    size_t c = (size - 1) / granularity;
+    ThreadCache& cache = t_cache;
+    cache.frees[c]++;
+
+    FreeSlot* slot = static_cast<FreeSlot*>(p);
+    slot->next = cache.free[c];
+    cache.free[c] = slot;
+    if ((++cache.freeCount[c] > cache.trimAt[c]) && useTrim()) {
+        trimClass(c);
+    }
+}
+
+std::vector<Pool::Stats> Pool::stats()
+{
+    std::vector<Stats> result;
+    std::lock_guard<std::mutex> lock(s_lock);
+    for (size_t c = 0; c < classCount; c++) {
+        const SizeClass& shared = s_classes[c];
+        Stats stats;
+        stats.objectSize  = objectSize(c);
+        stats.allocations = shared.allocations + t_cache.allocations[c];
+        stats.frees       = shared.frees + t_cache.frees[c];
+        stats.blocks      = shared.blockCount;
+        stats.capacity    = shared.blockCount * slotsPerBlock(c);
+        result.push_back(stats);
+    }
+    return result;
+}
@@ -0,0 +1,49 @@
+#ifndef INCLUDE_POOL_H
+#define INCLUDE_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Free-list pools for the small, fixed-size objects the interpreter makes
+// and drops all the time: values and environments. Requests are rounded up
+// to a size class, and each class hands out slots carved from large blocks
+// that only ever hold objects of that class.
+//
+// Each thread keeps its own free lists, so allocating and freeing take no
+// locks. A slot may be freed on a different thread to the one that made
+// it, in which case it simply joins that thread's free list. When a thread
+// exits, its free slots are handed over for other threads to reuse.
+//
+// Blocks are normally kept for the life of the process. Setting
+// MAL_POOL_TRIM lets a thread hand completely empty blocks back to the OS
+// once it has built up a lot of free slots.
+class Pool {
+public:
+    // Returns a slot for an object of the given size, or NULL if the size
+    // is too large to be pooled.
+    static void* allocate(size_t size);
+
+    // Gives back a slot that allocate returned for the same size.
+    static void free(void* p, size_t size);
+
+    // Whether objects of this size come from the pools.
+    static bool isPooled(size_t size) { return size <= maxObjectSize; }
+
+    struct Stats {
+        size_t   objectSize;
+        uint64_t allocations;
+        uint64_t frees;
+        size_t   blocks;
+        size_t   capacity;      // slots in those blocks
+    };
+
+    // One entry per size class, covering exited threads and the calling
+    // thread. Other running threads' counts are not included.
+    static std::vector<Stats> stats();
+
+private:
+    static const size_t maxObjectSize = 128;
+};
+
+#endif // INCLUDE_POOL_H
@@ -1,34 +1,142 @@
 #include "MAL.h"
+#include "MappedFile.h"
+#include "Reader.h"
+#include "Scanner.h"
 #include "Types.h"
 
-#include <regex>
+#include <algorithm>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+
+// Character classes used by the tokeniser, one bitmask per byte value.
+enum {
+    CC_WHITESPACE   = 1 << 0,   // skipped between tokens, includes ','
+    CC_SPECIAL      = 1 << 1,   // single-character tokens: []{}()'`~^@
+    CC_DELIMITER    = 1 << 2,   // terminates a symbol or number token
+};
+
+class CharClassTable
+{
+public:
+    CharClassTable();
+
+    bool is(char c, int mask) const {
+        return (m_table[static_cast<unsigned char>(c)] & mask) != 0;
+    }
+
+private:
+    void set(const char* chars, int mask);
+
+    unsigned char m_table[256];
+};
+
+CharClassTable::CharClassTable()
+{
+    for (auto &entry : m_table) {
+        entry = 0;
+    }
+    set(" \t\n\v\f\r,",  CC_WHITESPACE | CC_DELIMITER);
+    set("[]{}()'`~^@",      CC_SPECIAL);
+    set("[]{}('\"`;)",      CC_DELIMITER);
+}
+
+void CharClassTable::set(const char* chars, int mask)
+{
+    for (const char* p = chars; *p != '\0'; ++p) {
+        m_table[static_cast<unsigned char>(*p)] |= mask;
+    }
+}
+
+static const CharClassTable charClass;
+
+static const char* skipSpace(const char* it, const char* end)
+{
+    while (it != end) {
+        if (charClass.is(*it, CC_WHITESPACE)) {
+            // Most gaps are a single space, so only a longer run (such as
+            // indentation) is worth handing over to the block scan.
+            ++it;
+            if ((it != end) && charClass.is(*it, CC_WHITESPACE)) {
+                it = findNonSpace(it, end);
+            }
+        }
+        else if (*it == ';') {
+            it = findLineEnd(it, end);
+        }
+        else {
+            break;
+        }
+    }
+    return it;
+}
 
-typedef std::regex              Regex;
+static const char* skipString(const char* it, const char* end)
+{
+    // it points just past the opening quote. Returns the position just
+    // past the closing quote, or NULL if the string isn't terminated.
+    while (1) {
+        it = findQuoteOrEscape(it, end);
+        if (it == end) {
+            return NULL;
+        }
+        if (*it++ == '"') {
+            return it;
+        }
+        if (it != end) {
+            ++it;
+        }
+    }
+}
+
+// A non-owning view of a token within the reader's input buffer. Tokens
+// are only copied into a String when a value actually needs one.
+class Token
+{
+public:
+    Token() : m_begin(NULL), m_end(NULL) { }
+    Token(const char* begin, const char* end)
+        : m_begin(begin), m_end(end) { }
+
+    const char* begin() const { return m_begin; }
+    const char* end()   const { return m_end; }
+    int size() const { return m_end - m_begin; }
+
+    char operator [] (int index) const { return m_begin[index]; }
+
+    bool is(char c) const {
+        return (size() == 1) && (*m_begin == c);
+    }
+
+    bool operator == (const char* text) const {
+        int length = strlen(text);
+        return (length == size()) && (memcmp(m_begin, text, length) == 0);
+    }
 
-static const Regex intRegex("^[-+]?\\d+$");
-static const Regex closeRegex("[\\)\\]}]");
+    String str() const { return String(m_begin, m_end); }
 
-static const Regex whitespaceRegex("[\\s,]+|;.*");
-static const Regex tokenRegexes[] = {
-    Regex("~@"),
-    Regex("[\\[\\]{}()'`~^@]"),
-    Regex("\"(?:\\\\.|[^\\\\\"])*\""),
-    Regex("[^\\s\\[\\]{}('\"`,;)]+"),
+private:
+    const char* m_begin;
+    const char* m_end;
 };
 
+// Used with "%.*s" to format a token without copying it.
+#define TOKEN_ARGS(token)   (token).size(), (token).begin()
+
 class Tokeniser
 {
 public:
-    Tokeniser(const String& input);
+    Tokeniser(const char* begin, const char* end);
 
-    String peek() const {
+    Token peek() const {
         ASSERT(!eof(), "Tokeniser reading past EOF in peek\n");
         return m_token;
     }
 
-    String next() {
+    Token next() {
         ASSERT(!eof(), "Tokeniser reading past EOF in next\n");
-        String ret = peek();
+        Token ret = peek();
         nextToken();
         return ret;
     }
@@ -41,116 +149,497 @@ private:
     void skipWhitespace();
     void nextToken();
 
-    bool matchRegex(const Regex& regex);
-
-    typedef String::const_iterator StringIter;
+    const char* scanString(const char* it) const;
+    const char* scanAtom(const char* it) const;
 
-    String      m_token;
-    StringIter  m_iter;
-    StringIter  m_end;
+    Token       m_token;
+    const char* m_iter;
+    const char* m_end;
 };
 
-Tokeniser::Tokeniser(const String& input)
-:   m_iter(input.begin())
-,   m_end(input.end())
+Tokeniser::Tokeniser(const char* begin, const char* end)
+:   m_token(begin, begin)
+,   m_iter(begin)
+,   m_end(end)
 {
     nextToken();
 }
 
-bool Tokeniser::matchRegex(const Regex& regex)
+void Tokeniser::nextToken()
 {
+    // Don't advance m_iter until the token has been consumed in next().
+    // If we do it any earlier, we hit eof() when there's still one token left.
+    m_iter = m_token.end();
+
+    skipWhitespace();
     if (eof()) {
-        return false;
+        m_token = Token(m_end, m_end);
+        return;
     }
 
-    std::smatch match;
-    auto flags = std::regex_constants::match_continuous;
-    if (!std::regex_search(m_iter, m_end, match, regex, flags)) {
-        return false;
+    const char* tokenEnd;
+    char c = *m_iter;
+    if ((c == '~') && (m_iter + 1 != m_end) && (m_iter[1] == '@')) {
+        tokenEnd = m_iter + 2;
+    }
+    else if (charClass.is(c, CC_SPECIAL)) {
+        tokenEnd = m_iter + 1;
+    }
+    else if (c == '"') {
+        tokenEnd = scanString(m_iter + 1);
     }
+    else {
+        tokenEnd = scanAtom(m_iter);
+    }
+    m_token = Token(m_iter, tokenEnd);
+}
 
-    ASSERT(match.size() == 1, "Should only have one submatch, not %lu\n",
-                              match.size());
-    ASSERT(match.position(0) == 0, "Need to match first character\n");
-    ASSERT(match.length(0) > 0, "Need to match a non-empty string\n");
+const char* Tokeniser::scanString(const char* it) const
+{
+    it = skipString(it, m_end);
+    MAL_CHECK(it != NULL, "expected '\"', got EOF");
+    return it;
+}
 
-    // Don't advance  m_iter now, do it after we've consumed the token in
-    // next().  If we do it now, we hit eof() when there's still one token left.
-    m_token = match.str(0);
+const char* Tokeniser::scanAtom(const char* it) const
+{
+    while ((it != m_end) && !charClass.is(*it, CC_DELIMITER)) {
+        ++it;
+    }
+    return it;
+}
 
-    return true;
+void Tokeniser::skipWhitespace()
+{
+    m_iter = skipSpace(m_iter, m_end);
 }
 
-void Tokeniser::nextToken()
+static bool isCloseToken(const Token& token)
 {
-    m_iter += m_token.size();
+    return token.is(')') || token.is(']') || token.is('}');
+}
 
-    skipWhitespace();
-    if (eof()) {
-        return;
+// Decides whether token is a decimal integer and parses it in the same
+// pass. Returns false if it isn't one. A literal outside the int64 range
+// is an error, rather than being quietly truncated.
+static bool readInteger(const Token& token, int64_t& value)
+{
+    const char* it = token.begin();
+    const char* end = token.end();
+    bool isNegative = false;
+    if ((it != end) && ((*it == '-') || (*it == '+'))) {
+        isNegative = (*it == '-');
+        ++it;
+    }
+    if (it == end) {
+        return false;
     }
 
-    for (auto &it : tokenRegexes) {
-        if (matchRegex(it)) {
-            return;
+    // Accumulate the magnitude unsigned, so that INT64_MIN fits.
+    const uint64_t limit = isNegative ? uint64_t(INT64_MAX) + 1 : INT64_MAX;
+    uint64_t magnitude = 0;
+    bool isOverflow = false;
+    for ( ; it != end; ++it) {
+        unsigned digit = static_cast<unsigned char>(*it) - '0';
+        if (digit > 9) {
+            return false;
+        }
+        if (magnitude > (limit - digit) / 10) {
+            isOverflow = true;
+        }
+        else {
+            magnitude = magnitude * 10 + digit;
         }
     }
+    MAL_CHECK(!isOverflow, "integer out of range: %.*s", TOKEN_ARGS(token));
 
-    String mismatch(m_iter, m_end);
-    if (mismatch[0] == '"') {
-        MAL_CHECK(false, "expected '\"', got EOF");
-    }
-    else {
-        MAL_CHECK(false, "unexpected '%s'", mismatch.c_str());
-    }
+    value = isNegative ? -static_cast<int64_t>(magnitude - 1) - 1
+                       : static_cast<int64_t>(magnitude);
+    return true;
 }
 
-void Tokeniser::skipWhitespace()
+// Finds the end of the first top-level form in [it, end) without building
+// it, by following brackets, strings, comments and reader macros. Returns
+// NULL if the form isn't complete. An atom that runs up to the end of the
+// input only counts as complete if atEof is set, as more input could
+// extend it. Malformed input is passed over, and reported by the reader.
+static const char* scanForm(const char* it, const char* end, bool atEof)
 {
-    while (matchRegex(whitespaceRegex)) {
-        m_iter += m_token.size();
+    int formsNeeded = 1;
+    while (formsNeeded > 0) {
+        it = skipSpace(it, end);
+        if (it == end) {
+            return NULL;
+        }
+
+        char c = *it;
+        if ((c == '\'') || (c == '`') || (c == '@') || (c == '~')) {
+            // A reader macro applies to the form that follows it.
+            ++it;
+            continue;
+        }
+        if (c == '^') {
+            // Metadata is followed by both the metadata and the value.
+            ++it;
+            ++formsNeeded;
+            continue;
+        }
+        if ((c == '(') || (c == '[') || (c == '{')) {
+            int depth = 0;
+            while (1) {
+                it = skipSpace(it, end);
+                if (it == end) {
+                    return NULL;
+                }
+                c = *it;
+                if (c == '"') {
+                    it = skipString(it + 1, end);
+                    if (it == NULL) {
+                        return NULL;
+                    }
+                }
+                else if ((c == '(') || (c == '[') || (c == '{')) {
+                    ++depth;
+                    ++it;
+                }
+                else if ((c == ')') || (c == ']') || (c == '}')) {
+                    ++it;
+                    if (--depth == 0) {
+                        break;
+                    }
+                }
+                else {
+                    ++it;
+                }
+            }
+        }
+        else if (c == '"') {
+            it = skipString(it + 1, end);
+            if (it == NULL) {
+                return NULL;
+            }
+        }
+        else if ((c == ')') || (c == ']') || (c == '}')) {
+            ++it;
+        }
+        else {
+            while ((it != end) && !charClass.is(*it, CC_DELIMITER)) {
+                ++it;
+            }
+            if ((it == end) && !atEof) {
+                return NULL;
+            }
+        }
+        --formsNeeded;
     }
+    return it;
 }
 
+// The items of the collections being read are gathered on one stack per
+// thread, so that each collection is allocated once, at its final size.
+// A ReadItems covers the items pushed since it was made, and pops them
+// again when it goes.
+class ReadItems {
+public:
+    ReadItems() : m_base(s_stack.size()) { }
+    ~ReadItems() { s_stack.erase(s_stack.begin() + m_base, s_stack.end()); }
+
+    void push(malValuePtr item) { s_stack.push_back(item); }
+
+    malValueIter begin() const { return s_stack.data() + m_base; }
+    malValueIter end() const   { return s_stack.data() + s_stack.size(); }
+
+private:
+    static thread_local malValueVec s_stack;
+    const size_t m_base;
+};
+
+thread_local malValueVec ReadItems::s_stack;
+
 static malValuePtr readAtom(Tokeniser& tokeniser);
 static malValuePtr readForm(Tokeniser& tokeniser);
-static void readList(Tokeniser& tokeniser, malValueVec* items,
-                      const String& end);
+static void readList(Tokeniser& tokeniser, ReadItems& items, char end);
 static malValuePtr processMacro(Tokeniser& tokeniser, const String& symbol);
 
 malValuePtr readStr(const String& input)
 {
-    Tokeniser tokeniser(input);
+    const char* begin = input.data();
+    Tokeniser tokeniser(begin, begin + input.size());
     if (tokeniser.eof()) {
         throw malEmptyInputException();
     }
     return readForm(tokeniser);
 }
 
+// Input is read in chunks of at least this size. When a form doesn't fit
+// in what has been buffered, the chunk grows with the buffer, so that
+// rescanning a large form stays linear overall.
+static const size_t minChunkSize = 64 * 1024;
+
+FormReader::FormReader(std::istream& in)
+: m_in(&in)
+, m_mapped(NULL)
+, m_pos(m_buffer.data())
+, m_end(m_pos)
+, m_line(1)
+, m_formLine(1)
+, m_eof(false)
+{
+
+}
+
+FormReader::FormReader(const char* begin, const char* end)
+: m_in(NULL)
+, m_mapped(NULL)
+, m_pos(begin)
+, m_end(end)
+, m_line(1)
+, m_formLine(1)
+, m_eof(true)
+{
+
+}
+
+FormReader::FormReader(MappedFile& file)
+: m_in(NULL)
+, m_mapped(&file)
+, m_pos(file.begin())
+, m_end(file.end())
+, m_line(1)
+, m_formLine(1)
+, m_eof(true)
+{
+
+}
+
+bool FormReader::next(malValuePtr& form)
+{
+    while (1) {
+        const char* begin = m_pos;
+        const char* end   = m_end;
+        const char* start = skipSpace(begin, end);
+        if (start == end) {
+            if (m_eof) {
+                m_line += std::count(begin, end, '\n');
+                m_pos = end;
+                return false;
+            }
+            fill();
+            continue;
+        }
+
+        const char* formEnd = scanForm(start, end, m_eof);
+        if (formEnd == NULL) {
+            if (!m_eof) {
+                fill();
+                continue;
+            }
+            // Let the reader report what is wrong with the last form.
+            formEnd = end;
+        }
+
+        m_line += std::count(begin, start, '\n');
+        m_formLine = m_line;
+
+        Tokeniser tokeniser(start, formEnd);
+        form = readForm(tokeniser);
+
+        m_line += std::count(start, formEnd, '\n');
+        m_pos = formEnd;
+        if (m_mapped != NULL) {
+            m_mapped->discardBefore(m_pos);
+        }
+        return true;
+    }
+}
+
+void FormReader::fill()
+{
+    // Drop everything that has already been read, then append a chunk.
+    m_buffer.erase(0, m_pos - m_buffer.data());
+
+    size_t oldSize = m_buffer.size();
+    size_t chunkSize = std::max(minChunkSize, oldSize);
+    m_buffer.resize(oldSize + chunkSize);
+    m_in->read(&m_buffer[oldSize], chunkSize);
+    size_t got = m_in->gcount();
+    m_buffer.resize(oldSize + got);
+    if (got < chunkSize) {
+        m_eof = true;
+    }
+
+    m_pos = m_buffer.data();
+    m_end = m_pos + m_buffer.size();
+}
+
+// Each thread is given roughly this much input per batch. Only one batch
+// of forms is held in memory at a time.
+static const size_t parallelChunkSize = 256 * 1024;
+
+ParallelFormReader::ParallelFormReader(const char* begin, const char* end,
+                                       int threadCount)
+: m_mapped(NULL)
+, m_pos(begin)
+, m_end(end)
+, m_line(1)
+, m_formLine(1)
+, m_threadCount(std::max(threadCount, 1))
+, m_chunkIndex(0)
+, m_formIndex(0)
+{
+
+}
+
+ParallelFormReader::ParallelFormReader(MappedFile& file, int threadCount)
+: m_mapped(&file)
+, m_pos(file.begin())
+, m_end(file.end())
+, m_line(1)
+, m_formLine(1)
+, m_threadCount(std::max(threadCount, 1))
+, m_chunkIndex(0)
+, m_formIndex(0)
+{
+
+}
+
+int ParallelFormReader::defaultThreadCount()
+{
+    if (const char* env = getenv("MAL_READER_THREADS")) {
+        return std::max(atoi(env), 1);
+    }
+    return 1;
+}
+
+bool ParallelFormReader::next(malValuePtr& form)
+{
+    while (1) {
+        if (m_chunkIndex < m_chunks.size()) {
+            Chunk& chunk = m_chunks[m_chunkIndex];
+            if (m_formIndex < chunk.forms.size()) {
+                // Hand over the chunk's reference, so that each form can
+                // be freed as soon as the caller is done with it.
+                form = chunk.forms[m_formIndex];
+                chunk.forms[m_formIndex] = malValuePtr();
+                m_formLine = chunk.lines[m_formIndex];
+                ++m_formIndex;
+                return true;
+            }
+            if (chunk.error) {
+                m_formLine = chunk.errorLine;
+                std::rethrow_exception(chunk.error);
+            }
+            ++m_chunkIndex;
+            m_formIndex = 0;
+            continue;
+        }
+        if (m_pos == m_end) {
+            return false;
+        }
+        readBatch();
+    }
+}
+
+#if MAL_TRACING_GC
+void ParallelFormReader::visitForms(ReferenceVisitor& visitor) const
+{
+    // Forms that have been handed out are already cleared.
+    for (auto it = m_chunks.begin(), end = m_chunks.end(); it != end; ++it) {
+        gcVisit(it->forms, visitor);
+    }
+}
+#endif
+
+void ParallelFormReader::readBatch()
+{
+    // Split the next batch into chunks that each end on a form boundary.
+    m_chunks.clear();
+    m_chunks.resize(m_threadCount);
+    size_t used = 0;
+    for (auto &chunk : m_chunks) {
+        const char* it = m_pos;
+        const char* target = it + std::min(parallelChunkSize,
+                                           static_cast<size_t>(m_end - it));
+        while (it < target) {
+            it = skipSpace(it, m_end);
+            if (it == m_end) {
+                break;
+            }
+            const char* formEnd = scanForm(it, m_end, true);
+            // An incomplete form runs to the end, and is reported there.
+            it = (formEnd != NULL) ? formEnd : m_end;
+        }
+
+        chunk.begin     = m_pos;
+        chunk.end       = it;
+        chunk.firstLine = m_line;
+        m_line += std::count(m_pos, it, '\n');
+        m_pos = it;
+        ++used;
+        if (m_pos == m_end) {
+            break;
+        }
+    }
+    m_chunks.resize(used);
+
+    // The first chunk is read on this thread, while the others run.
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < m_chunks.size(); ++i) {
+        threads.push_back(std::thread(readChunk, &m_chunks[i]));
+    }
+    readChunk(&m_chunks[0]);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    m_chunkIndex = 0;
+    m_formIndex = 0;
+    if (m_mapped != NULL) {
+        m_mapped->discardBefore(m_pos);
+    }
+}
+
+void ParallelFormReader::readChunk(Chunk* chunk)
+{
+    // Anything read here is only shared through the immortal interned
+    // values and constants, so no other locking is needed.
+    FormReader reader(chunk->begin, chunk->end);
+    try {
+        malValuePtr form;
+        while (reader.next(form)) {
+            chunk->forms.push_back(form);
+            chunk->lines.push_back(chunk->firstLine + reader.line() - 1);
+        }
+    }
+    catch (...) {
+        chunk->error = std::current_exception();
+        chunk->errorLine = chunk->firstLine + reader.line() - 1;
+    }
+}
+
 static malValuePtr readForm(Tokeniser& tokeniser)
 {
     MAL_CHECK(!tokeniser.eof(), "expected form, got EOF");
-    String token = tokeniser.peek();
+    Token token = tokeniser.peek();
 
-    MAL_CHECK(!std::regex_match(token, closeRegex),
-            "unexpected '%s'", token.c_str());
+    MAL_CHECK(!isCloseToken(token), "unexpected '%.*s'", TOKEN_ARGS(token));
 
-    if (token == "(") {
+    if (token.is('(')) {
         tokeniser.next();
-        std::unique_ptr<malValueVec> items(new malValueVec);
-        readList(tokeniser, items.get(), ")");
-        return mal::list(items.release());
+        ReadItems items;
+        readList(tokeniser, items, ')');
+        return mal::list(items.begin(), items.end());
     }
-    if (token == "[") {
+    if (token.is('[')) {
         tokeniser.next();
-        std::unique_ptr<malValueVec> items(new malValueVec);
-        readList(tokeniser, items.get(), "]");
-        return mal::vector(items.release());
+        ReadItems items;
+        readList(tokeniser, items, ']');
+        return mal::vector(items.begin(), items.end());
     }
-    if (token == "{") {
+    if (token.is('{')) {
         tokeniser.next();
-        malValueVec items;
-        readList(tokeniser, &items, "}");
+        ReadItems items;
+        readList(tokeniser, items, '}');
         return mal::hash(items.begin(), items.end(), false);
     }
     return readAtom(tokeniser);
@@ -162,7 +651,7 @@ static malValuePtr readAtom(Tokeniser& tokeniser)
         const char* token;
         const char* symbol;
     };
-    ReaderMacro macroTable[] = {
+    static const ReaderMacro macroTable[] = {
         { "@",   "deref" },
         { "`",   "quasiquote" },
         { "'",   "quote" },
@@ -174,25 +663,29 @@ static malValuePtr readAtom(Tokeniser& tokeniser)
         const char* token;
         malValuePtr value;
     };
-    Constant constantTable[] = {
+    static const Constant constantTable[] = {
         { "false",  mal::falseValue()  },
         { "nil",    mal::nilValue()          },
         { "true",   mal::trueValue()   },
     };
 
-    String token = tokeniser.next();
+    Token token = tokeniser.next();
     if (token[0] == '"') {
-        return mal::string(unescape(token));
+        return mal::string(unescape(token.begin(), token.end()));
     }
     if (token[0] == ':') {
-        return mal::keyword(token);
+        return mal::keyword(token.str());
     }
-    if (token == "^") {
+    if (token.is('^')) {
         malValuePtr meta = readForm(tokeniser);
         malValuePtr value = readForm(tokeniser);
         // Note that meta and value switch places
         return mal::list(mal::symbol("with-meta"), value, meta);
     }
+    int64_t number;
+    if (readInteger(token, number)) {
+        return mal::integer(number);
+    }
     for (auto &constant : constantTable) {
         if (token == constant.token) {
             return constant.value;
@@ -203,22 +696,18 @@ static malValuePtr readAtom(Tokeniser& tokeniser)
             return processMacro(tokeniser, macro.symbol);
         }
     }
-    if (std::regex_match(token, intRegex)) {
-        return mal::integer(token);
-    }
-    return mal::symbol(token);
+    return mal::symbol(token.str());
 }
 
-static void readList(Tokeniser& tokeniser, malValueVec* items,
-                      const String& end)
+static void readList(Tokeniser& tokeniser, ReadItems& items, char end)
 {
     while (1) {
-        MAL_CHECK(!tokeniser.eof(), "expected '%s', got EOF", end.c_str());
-        if (tokeniser.peek() == end) {
+        MAL_CHECK(!tokeniser.eof(), "expected '%c', got EOF", end);
+        if (tokeniser.peek().is(end)) {
             tokeniser.next();
             return;
         }
-        items->push_back(readForm(tokeniser));
+        items.push(readForm(tokeniser));
     }
 }
 
@@ -0,0 +1,109 @@
+#ifndef INCLUDE_READER_H
+#define INCLUDE_READER_H
+
+#include "MAL.h"
+
+#include <exception>
+#include <istream>
+#include <vector>
+
+class MappedFile;
+
+// A sequence of top-level forms, as loaded by load-file.
+class FormSource {
+public:
+    virtual ~FormSource() { }
+
+    // Returns false when there are no more forms.
+    virtual bool next(malValuePtr& form) = 0;
+
+    // The source line on which the most recently read form started.
+    virtual int line() const = 0;
+
+#if MAL_TRACING_GC
+    // Visits the forms that have been read but not yet handed out.
+    virtual void visitForms(ReferenceVisitor& visitor) const { }
+#endif
+};
+
+#if MAL_TRACING_GC
+inline void gcVisit(const FormSource& slot, ReferenceVisitor& visitor)
+{
+    slot.visitForms(visitor);
+}
+#endif
+
+// Reads top-level forms one at a time, either from memory (such as a
+// mapped file) or from a stream. When reading a stream, only the form
+// being read (plus one chunk of lookahead) is buffered, so the memory
+// needed is proportional to the largest form rather than the whole input.
+class FormReader : public FormSource {
+public:
+    FormReader(std::istream& in);
+    FormReader(const char* begin, const char* end);
+    FormReader(MappedFile& file);
+
+    virtual bool next(malValuePtr& form);
+    virtual int line() const { return m_formLine; }
+
+private:
+    void fill();
+
+    std::istream*   m_in;       // NULL when reading from memory
+    MappedFile*     m_mapped;   // pages are released as they are read
+    String          m_buffer;   // holds the unread part of the stream
+    const char*     m_pos;
+    const char*     m_end;
+    int             m_line;
+    int             m_formLine;
+    bool            m_eof;
+};
+
+// Reads the top-level forms of an in-memory input on several threads.
+// The input is first split at form boundaries, which only needs a scan of
+// the brackets, strings and comments, and each batch of input is then read
+// as one chunk per thread. Forms are handed out in their original order,
+// and a read error is only reported once every form before it has been.
+class ParallelFormReader : public FormSource {
+public:
+    ParallelFormReader(const char* begin, const char* end, int threadCount);
+    ParallelFormReader(MappedFile& file, int threadCount);
+
+    virtual bool next(malValuePtr& form);
+    virtual int line() const { return m_formLine; }
+
+#if MAL_TRACING_GC
+    virtual void visitForms(ReferenceVisitor& visitor) const;
+#endif
+
+    // The number of threads to read with, from MAL_READER_THREADS. It is
+    // 1, so files are read on the calling thread, unless that is set, as
+    // the speed-up hasn't been measured yet.
+    static int defaultThreadCount();
+
+private:
+    struct Chunk {
+        const char*         begin;
+        const char*         end;
+        int                 firstLine;
+        malValueVec         forms;
+        std::vector<int>    lines;
+        std::exception_ptr  error;
+        int                 errorLine;
+    };
+
+    void readBatch();
+    static void readChunk(Chunk* chunk);
+
+    MappedFile*         m_mapped;   // pages are released after each batch
+    const char*         m_pos;
+    const char*         m_end;
+    int                 m_line;
+    int                 m_formLine;
+    int                 m_threadCount;
+    std::vector<Chunk>  m_chunks;
+    size_t              m_chunkIndex;
+    size_t              m_formIndex;
+};
+
+#endif // INCLUDE_READER_H
@@ -1,24 +1,165 @@
 #ifndef INCLUDE_REFCOUNTEDPTR_H
 #define INCLUDE_REFCOUNTEDPTR_H
 
+#include "Arena.h"
+#include "CycleCollector.h"
 #include "Debug.h"
+#include "DestroyQueue.h"
+#include "Gc.h"
+#include "Pool.h"
 
 #include <cstddef>
 
+#if DEBUG_REFCOUNT_OPS
+    // Counts every acquire and release that writes a refcount. The total
+    // is reported at exit.
+    extern unsigned long long refCountOps;
+    #define COUNT_REFCOUNT_OP()  (++refCountOps)
+#else
+    #define COUNT_REFCOUNT_OP()  NOOP
+#endif
+
 class RefCounted {
 public:
-    RefCounted() : m_refCount(0) { }
+    RefCounted()
+        : m_refCount(0), m_isInArena(Arena::claim(this)), m_gcFlags(0) { }
     virtual ~RefCounted() { }
 
-    const RefCounted* acquire() const { m_refCount++; return this; }
-    int release() const { return --m_refCount; }
+    // Memory comes from the current arena if there is one, then from the
+    // pools if the size is small enough, and only then from the heap.
+    static void* allocate(size_t size) {
+        DestroyQueue::payDebt();
+        CycleCollector::poll();
+        void* p = Arena::allocate(size);
+        if (p == NULL) {
+            p = Pool::allocate(size);
+        }
+        return (p != NULL) ? p : ::operator new(size);
+    }
+
+    static void deallocate(void* p, size_t size) {
+        // Arena memory only gets here if a constructor throws.
+        if (Arena::owns(p)) {
+            Arena::release(p);
+        }
+        else if (Pool::isPooled(size)) {
+            Pool::free(p, size);
+        }
+        else {
+            ::operator delete(p);
+        }
+    }
+
+    static void* operator new(size_t size) {
+        return allocate(size);
+    }
+
+    // The destructor is virtual, so size is that of the whole object.
+    static void operator delete(void* p, size_t size) {
+        deallocate(p, size);
+    }
+
+    // Called when the count drops to zero. The object is destroyed from
+    // the DestroyQueue, so that its children are not destroyed recursively.
+    void destroy() const {
+        // A buffered root is still on the cycle collector's list, so it
+        // is left for the next collection to destroy.
+        if ((m_gcFlags & gcBuffered) == 0) {
+            DestroyQueue::push(this);
+        }
+    }
+
+#if MAL_TRACING_GC
+    // The collector finds dead objects itself, so there is no count to
+    // keep, and a pointer only has to make sure its object is tracked.
+    const RefCounted* adopt() const {
+        if (((m_gcFlags & gcTracked) == 0) && (m_refCount != immortalCount)) {
+            m_gcFlags |= gcTracked;
+            Gc::track(this);
+        }
+        return this;
+    }
+    const RefCounted* acquire() const { return this; }
+    int release() const { return 1; }
+#else
+    // Takes a reference from a plain pointer.
+    const RefCounted* adopt() const { return acquire(); }
+
+    const RefCounted* acquire() const {
+        if (m_refCount != immortalCount) {
+            COUNT_REFCOUNT_OP();
+            m_refCount++;
+        }
+        return this;
+    }
+    int release() const {
+        if (m_refCount == immortalCount) {
+            return immortalCount;
+        }
+        COUNT_REFCOUNT_OP();
+        int count = --m_refCount;
+        if ((count != 0)
+            && ((m_gcFlags & (gcCandidate | gcBuffered)) == gcCandidate)) {
+            CycleCollector::addRoot(this);
+        }
+        return count;
+    }
+#endif
     int refCount() const { return m_refCount; }
 
+    // Immortal objects are never freed, and their count is never written
+    // again, so they can be shared between threads without locking.
+    void makeImmortal() const { m_refCount = immortalCount; }
+
+    // Calls visitor.visit on each object this one holds a reference to,
+    // for the cycle collector.
+    virtual void visitReferences(ReferenceVisitor& visitor) const { }
+
+    // Lets go of anything that could hold this object in a cycle. Only
+    // called once the collector has found that the object is garbage.
+    virtual void dropReferences() { }
+
+protected:
+    // For classes whose objects can be part of a reference cycle.
+    void makeCycleCandidate() const { m_gcFlags |= gcCandidate; }
+
+    // Destroys the object and frees its memory. Classes that allocate more
+    // than their own size must override this.
+    virtual void dispose() const { delete this; }
+
 private:
+    friend class CycleCollector;
+    friend class CycleCollectorImpl;
+    friend class DestroyQueue;
+    friend class GcImpl;
+
+    void destroyNow() const {
+        if (m_isInArena) {
+            this->~RefCounted();
+            Arena::release(this);
+        }
+        else {
+            dispose();
+        }
+    }
+
+    static const int immortalCount = -1;
+
     RefCounted(const RefCounted&); // no copy ctor
     RefCounted& operator = (const RefCounted&); // no assignments
 
-    mutable int m_refCount;
+    // The cycle collector's state.
+    enum {
+        gcColorMask = 3,        // see CycleCollector.cpp
+        gcBuffered  = 4,
+        gcCandidate = 8,
+        gcTracked   = 16,       // see Gc.cpp
+        gcMarked    = 32,
+    };
+
+    mutable int           m_refCount;
+    const bool            m_isInArena;
+    mutable unsigned char m_gcFlags;
 };
 
 template<class T>
@@ -26,17 +167,32 @@ class RefCountedPtr {
 public:
     RefCountedPtr() : m_object(0) { }
 
-    RefCountedPtr(T* object) : m_object(0)
-    { acquire(object); }
+    RefCountedPtr(T* object) : m_object(object) {
+        if (object != NULL) {
+            object->adopt();
+        }
+    }
 
     RefCountedPtr(const RefCountedPtr& rhs) : m_object(0)
     { acquire(rhs.m_object); }
 
+    RefCountedPtr(RefCountedPtr&& rhs) : m_object(rhs.m_object)
+    { rhs.m_object = NULL; }
+
     const RefCountedPtr& operator = (const RefCountedPtr& rhs) {
         acquire(rhs.m_object);
         return *this;
     }
 
+    const RefCountedPtr& operator = (RefCountedPtr&& rhs) {
+        if (this != &rhs) {
+            release();
+            m_object = rhs.m_object;
+            rhs.m_object = NULL;
+        }
+        return *this;
+    }
+
     bool operator == (const RefCountedPtr& rhs) const {
         return m_object == rhs.m_object;
     }
@@ -56,6 +212,12 @@ public:
     T* operator -> () const { return m_object; }
     T* ptr() const { return m_object; }
 
+    void visit(ReferenceVisitor& visitor) const {
+        if (m_object != NULL) {
+            visitor.visit(m_object);
+        }
+    }
+
 private:
     void acquire(T* object) {
         if (object != NULL) {
@@ -67,11 +229,63 @@ private:
 
     void release() {
         if ((m_object != NULL) && (m_object->release() == 0)) {
-            delete m_object;
+            m_object->destroy();
         }
     }
 
     T* m_object;
 };
 
+// A pointer to an object that something else owns. Copying it never
+// touches the refcount, so it suits parameters that are only used during
+// the call. Converting it to a RefCountedPtr takes a reference, for when
+// the object has to be kept.
+template<class T>
+class BorrowedPtr {
+public:
+    BorrowedPtr() : m_object(NULL) { }
+    BorrowedPtr(T* object) : m_object(object) { }
+    BorrowedPtr(const RefCountedPtr<T>& owner) : m_object(owner.ptr()) { }
+
+    // Borrowing from a temporary would leave the pointer dangling once the
+    // temporary has gone.
+    BorrowedPtr& operator = (RefCountedPtr<T>&&) = delete;
+
+    operator RefCountedPtr<T> () const { return m_object; }
+
+    bool operator == (const BorrowedPtr& rhs) const {
+        return m_object == rhs.m_object;
+    }
+
+    bool operator != (const BorrowedPtr& rhs) const {
+        return m_object != rhs.m_object;
+    }
+
+    operator bool () const {
+        return m_object != NULL;
+    }
+
+    T* operator -> () const { return m_object; }
+    T* ptr() const { return m_object; }
+
+private:
+    T* m_object;
+};
+
+#if MAL_TRACING_GC
+template<class T>
+void gcVisit(const RefCountedPtr<T>& slot, ReferenceVisitor& visitor)
+{
+    slot.visit(visitor);
+}
+
+template<class T>
+void gcVisit(const BorrowedPtr<T>& slot, ReferenceVisitor& visitor)
+{
+    if (slot) {
+        visitor.visit(slot.ptr());
+    }
+}
+#endif
+
 #endif // INCLUDE_REFCOUNTEDPTR_H
@@ -0,0 +1,192 @@
+#include "Scanner.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define SCANNER_X86 1
+    #include <immintrin.h>
+#endif
+
+static bool isSpace(char c)
+{
+    // ' ', ',' and '\t' '\n' '\v' '\f' '\r', which are 9 to 13.
+    return (c == ' ') || (c == ',')
+        || (static_cast<unsigned char>(c - '\t') <= '\r' - '\t');
+}
+
+static const char* findNonSpaceScalar(const char* it, const char* end)
+{
+    while ((it != end) && isSpace(*it)) {
+        ++it;
+    }
+    return it;
+}
+
+static const char* findLineEndScalar(const char* it, const char* end)
+{
+    while ((it != end) && (*it != '\n') && (*it != '\r')) {
+        ++it;
+    }
+    return it;
+}
+
+static const char* findQuoteOrEscapeScalar(const char* it, const char* end)
+{
+    while ((it != end) && (*it != '"') && (*it != '\\')) {
+        ++it;
+    }
+    return it;
+}
+
+#if SCANNER_X86
+
+// Each kernel tests a whole block, and uses the byte mask of matches to
+// find the first one. The tail that doesn't fill a block is left to the
+// scalar loop, so nothing past end is ever read.
+
+__attribute__((target("sse2")))
+static const char* findNonSpaceSSE2(const char* it, const char* end)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i tab   = _mm_set1_epi8('\t');
+    const __m128i range = _mm_set1_epi8('\r' - '\t');
+    for ( ; end - it >= 16; it += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+        __m128i ctrl  = _mm_sub_epi8(block, tab);
+        __m128i match = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(block, space),
+                         _mm_cmpeq_epi8(block, comma)),
+            _mm_cmpeq_epi8(_mm_min_epu8(ctrl, range), ctrl));
+        unsigned mask = ~_mm_movemask_epi8(match) & 0xffff;
+        if (mask != 0) {
+            return it + __builtin_ctz(mask);
+        }
+    }
+    return findNonSpaceScalar(it, end);
+}
+
+__attribute__((target("sse2")))
+static const char* findEitherSSE2(const char* it, const char* end,
+                                  char a, char b)
+{
+    const __m128i first  = _mm_set1_epi8(a);
+    const __m128i second = _mm_set1_epi8(b);
+    for ( ; end - it >= 16; it += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+        __m128i match = _mm_or_si128(_mm_cmpeq_epi8(block, first),
+                                     _mm_cmpeq_epi8(block, second));
+        unsigned mask = _mm_movemask_epi8(match);
+        if (mask != 0) {
+            return it + __builtin_ctz(mask);
+        }
+    }
+    return it;
+}
+
+__attribute__((target("sse2")))
+static const char* findLineEndSSE2(const char* it, const char* end)
+{
+    return findLineEndScalar(findEitherSSE2(it, end, '\n', '\r'), end);
+}
+
+__attribute__((target("sse2")))
+static const char* findQuoteOrEscapeSSE2(const char* it, const char* end)
+{
+    return findQuoteOrEscapeScalar(findEitherSSE2(it, end, '"', '\\'), end);
+}
+
+__attribute__((target("avx2")))
+static const char* findNonSpaceAVX2(const char* it, const char* end)
+{
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i tab   = _mm256_set1_epi8('\t');
+    const __m256i range = _mm256_set1_epi8('\r' - '\t');
+    for ( ; end - it >= 32; it += 32) {
+        __m256i block =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(it));
+        __m256i ctrl  = _mm256_sub_epi8(block, tab);
+        __m256i match = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, space),
+                            _mm256_cmpeq_epi8(block, comma)),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(ctrl, range), ctrl));
+        unsigned mask = ~_mm256_movemask_epi8(match);
+        if (mask != 0) {
+            return it + __builtin_ctz(mask);
+        }
+    }
+    return findNonSpaceScalar(it, end);
+}
+
+__attribute__((target("avx2")))
+static const char* findEitherAVX2(const char* it, const char* end,
+                                  char a, char b)
+{
+    const __m256i first  = _mm256_set1_epi8(a);
+    const __m256i second = _mm256_set1_epi8(b);
+    for ( ; end - it >= 32; it += 32) {
+        __m256i block =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(it));
+        __m256i match = _mm256_or_si256(_mm256_cmpeq_epi8(block, first),
+                                        _mm256_cmpeq_epi8(block, second));
+        unsigned mask = _mm256_movemask_epi8(match);
+        if (mask != 0) {
+            return it + __builtin_ctz(mask);
+        }
+    }
+    return it;
+}
+
+__attribute__((target("avx2")))
+static const char* findLineEndAVX2(const char* it, const char* end)
+{
+    return findLineEndScalar(findEitherAVX2(it, end, '\n', '\r'), end);
+}
+
+__attribute__((target("avx2")))
+static const char* findQuoteOrEscapeAVX2(const char* it, const char* end)
+{
+    return findQuoteOrEscapeScalar(findEitherAVX2(it, end, '"', '\\'), end);
+}
+
+#endif // SCANNER_X86
+
+typedef const char* (*ScanFunc)(const char* it, const char* end);
+
+struct ScanKernels {
+    ScanFunc nonSpace;
+    ScanFunc lineEnd;
+    ScanFunc quoteOrEscape;
+};
+
+static ScanKernels selectKernels()
+{
+#if SCANNER_X86
+    // This runs during static initialisation, so the CPU feature flags
+    // may not have been set up yet.
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return { findNonSpaceAVX2, findLineEndAVX2, findQuoteOrEscapeAVX2 };
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return { findNonSpaceSSE2, findLineEndSSE2, findQuoteOrEscapeSSE2 };
+    }
+#endif
+    return { findNonSpaceScalar, findLineEndScalar, findQuoteOrEscapeScalar };
+}
+
+static const ScanKernels kernels = selectKernels();
+
+const char* findNonSpace(const char* it, const char* end)
+{
+    return kernels.nonSpace(it, end);
+}
+
+const char* findLineEnd(const char* it, const char* end)
+{
+    return kernels.lineEnd(it, end);
+}
+
+const char* findQuoteOrEscape(const char* it, const char* end)
+{
+    return kernels.quoteOrEscape(it, end);
+}
@@ -0,0 +1,18 @@
+#ifndef INCLUDE_SCANNER_H
+#define INCLUDE_SCANNER_H
+
+// Block-at-a-time searches used by the reader to get through the bytes it
+// doesn't need to look at individually. Each returns end if nothing is
+// found. On x86 they use AVX2 or SSE2 where the CPU supports it, and fall
+// back to a byte loop elsewhere.
+
+// The first byte that isn't whitespace (which includes ',').
+extern const char* findNonSpace(const char* it, const char* end);
+
+// The first '\n' or '\r', which ends a comment.
+extern const char* findLineEnd(const char* it, const char* end);
+
+// The first '"' or '\\' inside a string literal.
+extern const char* findQuoteOrEscape(const char* it, const char* end);
+
+#endif // INCLUDE_SCANNER_H
@@ -66,23 +66,44 @@ static char unescape(char c)
 
 String unescape(const String& in)
 {
-    String out;
-    out.reserve(in.size()); // unescaped string will always be shorter
+    return unescape(in.data(), in.data() + in.size());
+}
 
+String unescape(const char* begin, const char* end)
+{
     // in will have double-quotes at either end, so move the iterators in
-    for (auto it = in.begin()+1, end = in.end()-1; it != end; ++it) {
-        char c = *it;
-        if (c == '\\') {
-            ++it;
-            if (it != end) {
-                out += unescape(*it);
-            }
-        }
-        else {
-            out += c;
+    const char* it = begin + 1;
+    const char* last = end - 1;
+
+    // Most strings have no escapes, and can be copied in one go.
+    const char* escape = static_cast<const char*>(
+        memchr(it, '\\', last - it));
+    if (escape == NULL) {
+        return String(it, last);
+    }
+
+    String out;
+    out.reserve(last - it); // unescaped string will always be shorter
+    while (escape != NULL) {
+        out.append(it, escape);
+        it = escape + 1;
+        if (it != last) {
+            out += unescape(*it++);
         }
+        escape = static_cast<const char*>(memchr(it, '\\', last - it));
     }
+    out.append(it, last);
     out.shrink_to_fit();
     return out;
 }
 
+
+// FNV-1a, which is quick on short strings and spreads them well enough.
+uint32_t hashString(const String& s)
+{
+    uint32_t hash = 2166136261u;
+    for (auto it = s.begin(), end = s.end(); it != end; ++it) {
+        hash = (hash ^ static_cast<unsigned char>(*it)) * 16777619u;
+    }
+    return hash;
+}
@@ -1,6 +1,7 @@
 #ifndef INCLUDE_STRING_H
 #define INCLUDE_STRING_H
 
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -14,5 +15,9 @@ extern String stringPrintf(const char* fmt, ...);
 extern String copyAndFree(char* mallocedString);
 extern String escape(const String& s);
 extern String unescape(const String& s);
+extern String unescape(const char* begin, const char* end);
+
+// The same on every platform, unlike std::hash.
+extern uint32_t hashString(const String& s);
 
 #endif // INCLUDE_STRING_H
@@ -4,26 +4,67 @@
 
 #include <algorithm>
 #include <memory>
-#include <typeinfo>
+#include <mutex>
+#include <unordered_map>
+
+#if DEBUG_REFCOUNT_OPS
+unsigned long long refCountOps = 0;
+
+static struct RefCountOpsReport {
+    ~RefCountOpsReport() {
+        TRACE("refcount ops: %llu\n", refCountOps);
+    }
+} refCountOpsReport;
+#endif
+
+// Maps names to their unique instances. Interned values are never freed,
+// so raw pointers to them stay valid for the life of the program. They are
+// also immortal, so the parallel reader can share them between threads.
+template<class T>
+class InternTable {
+public:
+    T* intern(const String& name) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_ids.find(name);
+        if (it != m_ids.end()) {
+            return STATIC_CAST(T, m_values[it->second]);
+        }
+        int id = m_values.size();
+        Arena::Scope heap(false);
+        T* value = new T(name, id);
+        value->makeImmortal();
+        m_values.push_back(value);
+        m_ids.insert(std::make_pair(name, id));
+        return value;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::unordered_map<String, int> m_ids;
+    malValueVec m_values;
+};
+
+malKeyword* malKeyword::intern(const String& token)
+{
+    static InternTable<malKeyword> table;
+    return table.intern(token);
+}
+
+malSymbol* malSymbol::intern(const String& token)
+{
+    static InternTable<malSymbol> table;
+    return table.intern(token);
+}
 
 namespace mal {
     malValuePtr atom(malValuePtr value) {
         return malValuePtr(new malAtom(value));
     };
 
-    malValuePtr boolean(bool value) {
-        return value ? trueValue() : falseValue();
-    }
-
     malValuePtr builtin(const String& name, malBuiltIn::ApplyFunc handler) {
         return malValuePtr(new malBuiltIn(name, handler));
     };
 
-    malValuePtr falseValue() {
-        static malValuePtr c(new malConstant("false"));
-        return malValuePtr(c);
-    };
-
 
     malValuePtr hash(const malHash::Map& map) {
         return malValuePtr(new malHash(map));
@@ -34,80 +75,69 @@ namespace mal {
         return malValuePtr(new malHash(argsBegin, argsEnd, isEvaluated));
     }
 
-    malValuePtr integer(int64_t value) {
-        return malValuePtr(new malInteger(value));
-    };
-
-    malValuePtr integer(const String& token) {
-        return integer(std::stoi(token));
-    };
-
     malValuePtr keyword(const String& token) {
-        return malValuePtr(new malKeyword(token));
+        return malValuePtr(malKeyword::intern(token));
     };
 
-    malValuePtr lambda(const StringVec& bindings,
+    malValuePtr lambda(const malSymbolIdVec& bindings,
                        malValuePtr body, malEnvPtr env) {
-        return malValuePtr(new malLambda(bindings, body, env));
+        return malValuePtr(new malLambda(bindings, std::move(body),
+                                         std::move(env)));
     }
 
-    malValuePtr list(malValueVec* items) {
-        return malValuePtr(new malList(items));
+    malValuePtr list(malValueIter begin, malValueIter end) {
+        return malValuePtr(malList::create(begin, end));
     };
 
-    malValuePtr list(malValueIter begin, malValueIter end) {
-        return malValuePtr(new malList(begin, end));
+    malValuePtr list(const malValueVec& items) {
+        return malValuePtr(malList::create(items.data(),
+                                           items.data() + items.size()));
     };
 
     malValuePtr list(malValuePtr a) {
-        malValueVec* items = new malValueVec(1);
-        items->at(0) = a;
-        return malValuePtr(new malList(items));
+        malList* list = malList::create(1);
+        list->begin()[0] = std::move(a);
+        return malValuePtr(list);
     }
 
     malValuePtr list(malValuePtr a, malValuePtr b) {
-        malValueVec* items = new malValueVec(2);
-        items->at(0) = a;
-        items->at(1) = b;
-        return malValuePtr(new malList(items));
+        malList* list = malList::create(2);
+        list->begin()[0] = std::move(a);
+        list->begin()[1] = std::move(b);
+        return malValuePtr(list);
     }
 
     malValuePtr list(malValuePtr a, malValuePtr b, malValuePtr c) {
-        malValueVec* items = new malValueVec(3);
-        items->at(0) = a;
-        items->at(1) = b;
-        items->at(2) = c;
-        return malValuePtr(new malList(items));
+        malList* list = malList::create(3);
+        list->begin()[0] = std::move(a);
+        list->begin()[1] = std::move(b);
+        list->begin()[2] = std::move(c);
+        return malValuePtr(list);
     }
 
     malValuePtr macro(const malLambda& lambda) {
         return malValuePtr(new malLambda(lambda, true));
     };
 
-    malValuePtr nilValue() {
-        static malValuePtr c(new malConstant("nil"));
-        return malValuePtr(c);
-    };
-
     malValuePtr string(const String& token) {
         return malValuePtr(new malString(token));
     }
 
-    malValuePtr symbol(const String& token) {
-        return malValuePtr(new malSymbol(token));
-    };
+    malValuePtr string(const char* begin, const char* end) {
+        return malValuePtr(new malString(begin, end));
+    }
 
-    malValuePtr trueValue() {
-        static malValuePtr c(new malConstant("true"));
-        return malValuePtr(c);
+    malValuePtr symbol(const String& token) {
+        return malValuePtr(malSymbol::intern(token));
     };
 
-    malValuePtr vector(malValueVec* items) {
-        return malValuePtr(new malVector(items));
+    malValuePtr vector(malValueIter begin, malValueIter end) {
+        return malValuePtr(malVector::create(begin, end));
     };
 
-    malValuePtr vector(malValueIter begin, malValueIter end) {
-        return malValuePtr(new malVector(begin, end));
+    malValuePtr vector(const malValueVec& items) {
+        return malValuePtr(malVector::create(items.data(),
+                                             items.data() + items.size()));
     };
 };
 
@@ -117,27 +147,14 @@ malValuePtr malBuiltIn::apply(malValueIter argsBegin,
     return m_handler(m_name, argsBegin, argsEnd);
 }
 
-static String makeHashKey(malValuePtr key)
-{
-    if (const malString* skey = DYNAMIC_CAST(malString, key)) {
-        return skey->print(true);
-    }
-    else if (const malKeyword* kkey = DYNAMIC_CAST(malKeyword, key)) {
-        return kkey->print(true);
-    }
-    MAL_FAIL("%s is not a string or keyword", key->print(true).c_str());
-}
-
-static malHash::Map addToMap(malHash::Map& map,
+static void addToMap(malHash::Map& map,
     malValueIter argsBegin, malValueIter argsEnd)
 {
     // This is intended to be called with pre-evaluated arguments.
     for (auto it = argsBegin; it != argsEnd; ++it) {
-        String key = makeHashKey(*it++);
-        map[key] = *it;
+        const malValuePtr& key = *it++;
+        map.set(key, *it);
     }
-
-    return map;
 }
 
 static malHash::Map createMap(malValueIter argsBegin, malValueIter argsEnd)
@@ -146,18 +163,21 @@ static malHash::Map createMap(malValueIter argsBegin, malValueIter argsEnd)
             "hash-map requires an even-sized list");
 
     malHash::Map map;
-    return addToMap(map, argsBegin, argsEnd);
+    addToMap(map, argsBegin, argsEnd);
+    return map;
 }
 
 malHash::malHash(malValueIter argsBegin, malValueIter argsEnd, bool isEvaluated)
-: m_map(createMap(argsBegin, argsEnd))
+: malValue(TYPE_HASH)
+, m_map(createMap(argsBegin, argsEnd))
 , m_isEvaluated(isEvaluated)
 {
 
 }
 
 malHash::malHash(const malHash::Map& map)
-: m_map(map)
+: malValue(TYPE_HASH)
+, m_map(map)
 , m_isEvaluated(true)
 {
 
@@ -170,13 +190,13 @@ malHash::assoc(malValueIter argsBegin, malValueIter argsEnd) const
             "assoc requires an even-sized list");
 
     malHash::Map map(m_map);
-    return mal::hash(addToMap(map, argsBegin, argsEnd));
+    addToMap(map, argsBegin, argsEnd);
+    return mal::hash(map);
 }
 
 bool malHash::contains(malValuePtr key) const
 {
-    auto it = m_map.find(makeHashKey(key));
-    return it != m_map.end();
+    return m_map.find(key) != NULL;
 }
 
 malValuePtr
@@ -184,72 +204,71 @@ malHash::dissoc(malValueIter argsBegin, malValueIter argsEnd) const
 {
     malHash::Map map(m_map);
     for (auto it = argsBegin; it != argsEnd; ++it) {
-        String key = makeHashKey(*it);
-        map.erase(key);
+        map.erase(*it);
     }
     return mal::hash(map);
 }
 
-malValuePtr malHash::eval(malEnvPtr env)
+malValuePtr malHash::eval(malEnvRef env)
 {
     if (m_isEvaluated) {
         return malValuePtr(this);
     }
 
+    // Keys are evaluated too, now that they needn't be strings.
     malHash::Map map;
-    for (auto it = m_map.begin(), end = m_map.end(); it != end; ++it) {
-        map[it->first] = EVAL(it->second, env);
-    }
+    GC_ROOT(map);
+    m_map.forEach([&map, env](const malValuePtr& key,
+                              const malValuePtr& value) {
+        malValuePtr evaluated = EVAL(key, env);
+        GC_ROOT(evaluated);
+        map.set(evaluated, EVAL(value, env));
+    });
     return mal::hash(map);
 }
 
 malValuePtr malHash::get(malValuePtr key) const
 {
-    auto it = m_map.find(makeHashKey(key));
-    return it == m_map.end() ? mal::nilValue() : it->second;
+    const malValuePtr* value = m_map.find(key);
+    return (value != NULL) ? *value : mal::nilValue();
 }
 
 malValuePtr malHash::keys() const
 {
-    malValueVec* keys = new malValueVec();
-    keys->reserve(m_map.size());
-    for (auto it = m_map.begin(), end = m_map.end(); it != end; ++it) {
-        if (it->first[0] == '"') {
-            keys->push_back(mal::string(unescape(it->first)));
-        }
-        else {
-            keys->push_back(mal::keyword(it->first));
-        }
-    }
-    return mal::list(keys);
+    malList* keys = malList::create(m_map.size());
+    malValueIter out = keys->begin();
+    m_map.forEach([&out](const malValuePtr& key, const malValuePtr&) {
+        *out++ = key;
+    });
+    return malValuePtr(keys);
 }
 
 malValuePtr malHash::values() const
 {
-    malValueVec* keys = new malValueVec();
-    keys->reserve(m_map.size());
-    for (auto it = m_map.begin(), end = m_map.end(); it != end; ++it) {
-        keys->push_back(it->second);
-    }
-    return mal::list(keys);
+    malList* values = malList::create(m_map.size());
+    malValueIter out = values->begin();
+    m_map.forEach([&out](const malValuePtr&, const malValuePtr& value) {
+        *out++ = value;
+    });
+    return malValuePtr(values);
 }
 
 String malHash::print(bool readably) const
 {
     String s = "{";
 
-    auto it = m_map.begin(), end = m_map.end();
-    if (it != end) {
-        s += it->first + " " + it->second->print(readably);
-        ++it;
-    }
-    for ( ; it != end; ++it) {
-        s += " " + it->first + " " + it->second->print(readably);
-    }
+    const char* separator = "";
+    // Keys have always been printed readably.
+    m_map.forEach([&](const malValuePtr& key, const malValuePtr& value) {
+        s += separator + key->print(true) + " " + value->print(readably);
+        separator = " ";
+    });
 
     return s + "}";
 }
 
+// Maps are equal when they have the same keys with equal values, which
+// needn't be in the same order, so the keys are looked up.
 bool malHash::doIsEqualTo(const malValue* rhs) const
 {
     const malHash::Map& r_map = static_cast<const malHash*>(rhs)->m_map;
@@ -257,47 +276,59 @@ bool malHash::doIsEqualTo(const malValue* rhs) const
         return false;
     }
 
-    for (auto it0 = m_map.begin(), end0 = m_map.end(), it1 = r_map.begin();
-         it0 != end0; ++it0, ++it1) {
+    bool isEqual = true;
+    m_map.forEach([&](const malValuePtr& key, const malValuePtr& value) {
+        const malValuePtr* r_value = isEqual ? r_map.find(key) : NULL;
+        isEqual = (r_value != NULL) && value->isEqualTo(*r_value);
+    });
+    return isEqual;
+}
 
-        if (it0->first != it1->first) {
-            return false;
-        }
-        if (!it0->second->isEqualTo(it1->second.ptr())) {
-            return false;
-        }
-    }
-    return true;
+// Summed, so that it doesn't depend on the order of the entries.
+uint32_t malHash::hash() const
+{
+    uint32_t hash = TYPE_HASH;
+    m_map.forEach([&hash](const malValuePtr& key, const malValuePtr& value) {
+        hash += key->hash() * 31 + value->hash();
+    });
+    return hash;
 }
 
-malLambda::malLambda(const StringVec& bindings,
+void malHash::visitReferences(ReferenceVisitor& visitor) const
+{
+    malValue::visitReferences(visitor);
+    m_map.visit(visitor);
+}
+
+malLambda::malLambda(const malSymbolIdVec& bindings,
                      malValuePtr body, malEnvPtr env)
-: m_bindings(bindings)
-, m_body(body)
-, m_env(env)
+: malApplicable(TYPE_LAMBDA)
+, m_bindings(bindings)
+, m_body(std::move(body))
+, m_env(std::move(env))
 , m_isMacro(false)
 {
-
+    makeCycleCandidate();
 }
 
 malLambda::malLambda(const malLambda& that, malValuePtr meta)
-: malApplicable(meta)
+: malApplicable(TYPE_LAMBDA, meta)
 , m_bindings(that.m_bindings)
 , m_body(that.m_body)
 , m_env(that.m_env)
 , m_isMacro(that.m_isMacro)
 {
-
+    makeCycleCandidate();
 }
 
 malLambda::malLambda(const malLambda& that, bool isMacro)
-: malApplicable(that.m_meta)
+: malApplicable(TYPE_LAMBDA, that.meta())
 , m_bindings(that.m_bindings)
 , m_body(that.m_body)
 , m_env(that.m_env)
 , m_isMacro(isMacro)
 {
-
+    makeCycleCandidate();
 }
 
 malValuePtr malLambda::apply(malValueIter argsBegin,
@@ -306,6 +337,13 @@ malValuePtr malLambda::apply(malValueIter argsBegin,
     return EVAL(m_body, makeEnv(argsBegin, argsEnd));
 }
 
+void malLambda::visitReferences(ReferenceVisitor& visitor) const
+{
+    malApplicable::visitReferences(visitor);
+    m_body.visit(visitor);
+    m_env.visit(visitor);
+}
+
 malValuePtr malLambda::doWithMeta(malValuePtr meta) const
 {
     return new malLambda(*this, meta);
@@ -322,14 +360,14 @@ malValuePtr malList::conj(malValueIter argsBegin,
     int oldItemCount = std::distance(begin(), end());
     int newItemCount = std::distance(argsBegin, argsEnd);
 
-    malValueVec* items = new malValueVec(oldItemCount + newItemCount);
-    std::reverse_copy(argsBegin, argsEnd, items->begin());
-    std::copy(begin(), end(), items->begin() + newItemCount);
+    malList* list = malList::create(oldItemCount + newItemCount);
+    std::reverse_copy(argsBegin, argsEnd, list->begin());
+    std::copy(begin(), end(), list->begin() + newItemCount);
 
-    return mal::list(items);
+    return malValuePtr(list);
 }
 
-malValuePtr malList::eval(malEnvPtr env)
+malValuePtr malList::eval(malEnvRef env)
 {
     // Note, this isn't actually called since the TCO updates, but
     // is required for the earlier steps, so don't get rid of it.
@@ -337,10 +375,9 @@ malValuePtr malList::eval(malEnvPtr env)
         return malValuePtr(this);
     }
 
-    std::unique_ptr<malValueVec> items(evalItems(env));
-    auto it = items->begin();
-    malValuePtr op = *it;
-    return APPLY(op, ++it, items->end());
+    malValuePtr items = evalItems(env);
+    const malList* list = STATIC_CAST(malList, items);
+    return APPLY(list->item(0), list->begin() + 1, list->end());
 }
 
 String malList::print(bool readably) const
@@ -348,31 +385,90 @@ String malList::print(bool readably) const
     return '(' + malSequence::print(readably) + ')';
 }
 
-malValuePtr malValue::eval(malEnvPtr env)
+malValuePtr malValue::eval(malEnvRef env)
 {
     // Default case of eval is just to return the object itself.
     return malValuePtr(this);
 }
 
+// Spreads the bits of an integer or an address over the 32 bits of the
+// hash. This is the finalizer from MurmurHash3.
+static uint32_t hashInteger(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    return static_cast<uint32_t>(value);
+}
+
+uint32_t malValue::hash() const
+{
+    return hashInteger(reinterpret_cast<uintptr_t>(this));
+}
+
+uint32_t malInteger::hash() const
+{
+    return hashInteger(m_value);
+}
+
+uint32_t malStringBase::hash() const
+{
+    uint32_t hash = m_hash.load(std::memory_order_relaxed);
+    if (hash == 0) {
+        // A string, a keyword and a symbol with the same text differ.
+        hash = (hashString(m_value) ^ (type() * 0x9e3779b9u)) | 1;
+        m_hash.store(hash, std::memory_order_relaxed);
+    }
+    return hash;
+}
+
 bool malValue::isEqualTo(const malValue* rhs) const
 {
     // Special-case. Vectors and Lists can be compared.
-    bool matchingTypes = (typeid(*this) == typeid(*rhs)) ||
-        (dynamic_cast<const malSequence*>(this) &&
-         dynamic_cast<const malSequence*>(rhs));
+    bool matchingTypes = (m_type == rhs->m_type) ||
+        (malSequence::isTypeOf(m_type) && malSequence::isTypeOf(rhs->m_type));
 
     return matchingTypes && doIsEqualTo(rhs);
 }
 
-bool malValue::isTrue() const
+// Guarded by metaLock. Entries are removed by the value's destructor.
+static std::mutex metaLock;
+static std::unordered_map<const malValue*, malValuePtr> metaTable;
+
+malValue::malValue(malType type, malValuePtr meta)
+: m_type(type)
+, m_hasMeta(meta && (meta != mal::nilValue()))
 {
-    return (this != mal::falseValue().ptr())
-        && (this != mal::nilValue().ptr());
+    TRACE_OBJECT("Creating malValue %p\n", this);
+    if (m_hasMeta) {
+        std::lock_guard<std::mutex> lock(metaLock);
+        metaTable[this] = std::move(meta);
+    }
+}
+
+malValue::~malValue()
+{
+    TRACE_OBJECT("Destroying malValue %p\n", this);
+    if (m_hasMeta) {
+        // Move the metadata out first, so that it is released after the
+        // lock, in case releasing it destroys values with metadata too.
+        malValuePtr meta;
+        {
+            std::lock_guard<std::mutex> lock(metaLock);
+            auto it = metaTable.find(this);
+            meta = std::move(it->second);
+            metaTable.erase(it);
+        }
+    }
 }
 
 malValuePtr malValue::meta() const
 {
-    return m_meta.ptr() == NULL ? mal::nilValue() : m_meta;
+    if (!m_hasMeta) {
+        return mal::nilValue();
+    }
+    std::lock_guard<std::mutex> lock(metaLock);
+    return metaTable.find(this)->second;
 }
 
 malValuePtr malValue::withMeta(malValuePtr meta) const
@@ -380,28 +476,122 @@ malValuePtr malValue::withMeta(malValuePtr meta) const
     return doWithMeta(meta);
 }
 
-malSequence::malSequence(malValueVec* items)
-: m_items(items)
+void malValue::visitReferences(ReferenceVisitor& visitor) const
 {
+    if (!m_hasMeta) {
+        return;
+    }
+    // Visiting can lead back here, so don't hold the lock while doing it.
+    // The collector frees nothing while it visits, so the pointer stays
+    // good.
+    const malValue* meta;
+    {
+        std::lock_guard<std::mutex> lock(metaLock);
+        meta = metaTable.find(this)->second.ptr();
+    }
+    if (meta != NULL) {
+        visitor.visit(meta);
+    }
+}
 
+malValuePtr malValuePtr::eval(malEnvRef env) const
+{
+    return isObject() ? ptr()->eval(env) : *this;
+}
+
+bool malValuePtr::isEqualTo(const malValuePtr& rhs) const
+{
+    if (isObject() && rhs.isObject()) {
+        return ptr()->isEqualTo(rhs.ptr());
+    }
+    // An integer may be boxed if it is large or has metadata.
+    if (isInteger() && rhs.isInteger()) {
+        return integerValue() == rhs.integerValue();
+    }
+    return m_bits == rhs.m_bits;
+}
+
+uint32_t malValuePtr::hash() const
+{
+    if (isObject()) {
+        return ptr()->hash();
+    }
+    if (isImmediateInteger()) {
+        return hashInteger(integerValue());
+    }
+    return static_cast<uint32_t>(m_bits);
+}
+
+String malValuePtr::print(bool readably) const
+{
+    if (isImmediateInteger()) {
+        return std::to_string(integerValue());
+    }
+    switch (m_bits) {
+        case nilBits:   return "nil";
+        case falseBits: return "false";
+        case trueBits:  return "true";
+        default:        return ptr()->print(readably);
+    }
 }
 
-malSequence::malSequence(malValueIter begin, malValueIter end)
-: m_items(new malValueVec(begin, end))
+malValuePtr malValuePtr::withMeta(malValuePtr meta) const
 {
+    // Immediates can't carry metadata, so they get boxed.
+    if (isImmediateInteger()) {
+        return new malInteger(integerValue(), meta);
+    }
+    if (!isObject()) {
+        return new malConstant(print(true), meta);
+    }
+    return ptr()->withMeta(meta);
+}
 
+malSequence::malSequence(malType type, int count)
+: malValue(type)
+, m_items(inlineItems())
+, m_count(count)
+{
+    std::uninitialized_fill(begin(), end(), malValuePtr());
 }
 
-malSequence::malSequence(const malSequence& that, malValuePtr meta)
-: malValue(meta)
-, m_items(new malValueVec(*(that.m_items)))
+malSequence::malSequence(malType type,
+                         const malValuePtr* begin, const malValuePtr* end)
+: malValue(type)
+, m_items(inlineItems())
+, m_count(end - begin)
 {
+    std::uninitialized_copy(begin, end, this->begin());
+}
 
+malSequence::malSequence(malType type, const malValuePtr& owner,
+                         malValueIter begin, int count, malValuePtr meta)
+: malValue(type, std::move(meta))
+, m_items(begin)
+, m_count(count)
+{
+    ::new (inlineItems()) malValuePtr(owner);
 }
 
 malSequence::~malSequence()
 {
-    delete m_items;
+    if (isSlice()) {
+        inlineItems()->~malValuePtr();
+        return;
+    }
+    for (auto it = begin(), end = this->end(); it != end; ++it) {
+        it->~malValuePtr();
+    }
+}
+
+void malSequence::dispose() const
+{
+    // The destructor is virtual, and the memory has to be freed with the
+    // size it was allocated with, so do both steps here.
+    size_t size = allocationSize(isSlice() ? 1 : m_count);
+    void* memory = const_cast<malSequence*>(this);
+    this->~malSequence();
+    deallocate(memory, size);
 }
 
 bool malSequence::doIsEqualTo(const malValue* rhs) const
@@ -411,25 +601,42 @@ bool malSequence::doIsEqualTo(const malValue* rhs) const
         return false;
     }
 
-    for (malValueIter it0 = m_items->begin(),
+    for (malValueIter it0 = begin(),
                       it1 = rhsSeq->begin(),
-                      end = m_items->end(); it0 != end; ++it0, ++it1) {
+                      end = this->end(); it0 != end; ++it0, ++it1) {
 
-        if (! (*it0)->isEqualTo((*it1).ptr())) {
+        if (! (*it0)->isEqualTo(*it1)) {
             return false;
         }
     }
     return true;
 }
 
-malValueVec* malSequence::evalItems(malEnvPtr env) const
+// Lists and vectors with the same items are equal, so the type is left out.
+uint32_t malSequence::hash() const
 {
-    malValueVec* items = new malValueVec;;
-    items->reserve(count());
-    for (auto it = m_items->begin(), end = m_items->end(); it != end; ++it) {
-        items->push_back(EVAL(*it, env));
+    uint32_t hash = TYPE_LIST;
+    for (malValueIter it = begin(), end = this->end(); it != end; ++it) {
+        hash = (hash ^ (*it)->hash()) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns a sequence of the same type holding the evaluated items.
+malValuePtr malSequence::evalItems(malEnvRef env) const
+{
+    malSequence* seq = (m_type == TYPE_LIST)
+        ? static_cast<malSequence*>(malList::create(m_count))
+        : static_cast<malSequence*>(malVector::create(m_count));
+    malValuePtr result(seq);
+    GC_ROOT(result);
+    // The caller may only hold this in a temporary.
+    GC_ROOT_OBJECT(this);
+    malValueIter out = seq->begin();
+    for (auto it = begin(), end = this->end(); it != end; ++it) {
+        *out++ = EVAL(*it, env);
     }
-    return items;
+    return result;
 }
 
 malValuePtr malSequence::first() const
@@ -440,8 +647,8 @@ malValuePtr malSequence::first() const
 String malSequence::print(bool readably) const
 {
     String str;
-    auto end = m_items->cend();
-    auto it = m_items->cbegin();
+    auto end = this->end();
+    auto it = begin();
     if (it != end) {
         str += (*it)->print(readably);
         ++it;
@@ -453,10 +660,47 @@ String malSequence::print(bool readably) const
     return str;
 }
 
+// A slice of a slice refers straight to the sequence that owns the items,
+// so slices never keep a chain of other slices alive.
+malValuePtr malSequence::storageOwner() const
+{
+    return isSlice() ? *inlineItems()
+                     : malValuePtr(const_cast<malSequence*>(this));
+}
+
+malValuePtr malSequence::drop(int n) const
+{
+    if (n < 0) {
+        n = 0;
+    }
+    if (n >= m_count) {
+        return mal::list(end(), end());
+    }
+    return slice<malList>(n, malValuePtr());
+}
+
+void malSequence::dropReferences()
+{
+    if (!isSlice()) {
+        std::fill(begin(), end(), malValuePtr());
+    }
+}
+
+void malSequence::visitReferences(ReferenceVisitor& visitor) const
+{
+    malValue::visitReferences(visitor);
+    if (isSlice()) {
+        inlineItems()->visit(visitor);
+        return;
+    }
+    for (auto it = begin(), end = this->end(); it != end; ++it) {
+        it->visit(visitor);
+    }
+}
+
 malValuePtr malSequence::rest() const
 {
-    malValueIter start = (count() > 0) ? begin() + 1 : end();
-    return mal::list(start, end());
+    return drop(1);
 }
 
 String malString::escapedValue() const
@@ -469,27 +713,52 @@ String malString::print(bool readably) const
     return readably ? escapedValue() : value();
 }
 
-malValuePtr malSymbol::eval(malEnvPtr env)
+malValuePtr malSymbol::eval(malEnvRef env)
 {
-    return env->get(value());
+    return env->get(this);
 }
 
+// A vector made by conj is a slice of storage with room to spare, so that
+// building one up an item at a time doesn't copy it each time. The spare
+// slots are null, and are only ever filled from the first of them, so a
+// vector that ends at a null slot is the longest in its storage. It can
+// fill the slots after it without changing any other vector sharing the
+// storage, and the result shares it too. Anything else is copied into new
+// storage twice the size it needs.
+//
+// An item added in place can hold the storage itself, as in (conj v v),
+// so the storage is a candidate for the cycle collector like an atom.
 malValuePtr malVector::conj(malValueIter argsBegin,
                             malValueIter argsEnd) const
 {
-    int oldItemCount = std::distance(begin(), end());
+    int oldItemCount = count();
     int newItemCount = std::distance(argsBegin, argsEnd);
+    int itemCount = oldItemCount + newItemCount;
+
+    if (isSlice()) {
+        malValuePtr owner = storageOwner();
+        const malSequence* storage = STATIC_CAST(malSequence, owner);
+        if ((storage->type() == TYPE_VECTOR)
+                && (newItemCount <= storage->end() - end())
+                && (newItemCount > 0) && !*end()) {
+            std::copy(argsBegin, argsEnd, end());
+            return malValuePtr(malSequence::create<malVector>(
+                1, owner, begin(), itemCount, malValuePtr()));
+        }
+    }
 
-    malValueVec* items = new malValueVec(oldItemCount + newItemCount);
-    std::copy(begin(), end(), items->begin());
-    std::copy(argsBegin, argsEnd, items->begin() + oldItemCount);
-
-    return mal::vector(items);
+    malVector* storage = malVector::create(std::max(2 * itemCount, 4));
+    storage->makeCycleCandidate();
+    malValuePtr owner(storage);
+    std::copy(begin(), end(), storage->begin());
+    std::copy(argsBegin, argsEnd, storage->begin() + oldItemCount);
+    return malValuePtr(malSequence::create<malVector>(
+        1, owner, storage->begin(), itemCount, malValuePtr()));
 }
 
-malValuePtr malVector::eval(malEnvPtr env)
+malValuePtr malVector::eval(malEnvRef env)
 {
-    return mal::vector(evalItems(env));
+    return evalItems(env);
 }
 
 String malVector::print(bool readably) const
@@ -1,70 +1,126 @@
 #ifndef INCLUDE_TYPES_H
 #define INCLUDE_TYPES_H
 
+#include "HashTrie.h"
 #include "MAL.h"
 
+#include <atomic>
 #include <exception>
-#include <map>
+#include <new>
+#include <utility>
 
 class malEmptyInputException : public std::exception { };
 
+// Every concrete value class has a tag, so that type checks are integer
+// comparisons rather than RTTI. Each abstract class covers a contiguous
+// range of tags.
+enum malType : unsigned char {
+    TYPE_CONSTANT,
+    TYPE_INTEGER,
+    TYPE_STRING,        // malStringBase is STRING to SYMBOL
+    TYPE_KEYWORD,
+    TYPE_SYMBOL,
+    TYPE_LIST,          // malSequence is LIST to VECTOR
+    TYPE_VECTOR,
+    TYPE_HASH,
+    TYPE_BUILTIN,       // malApplicable is BUILTIN to LAMBDA
+    TYPE_LAMBDA,
+    TYPE_ATOM,
+};
+
+// Used by the casts below. Each class has to declare its own, or it
+// would inherit its base class's test.
+#define VALUE_TYPE(first, last) \
+    static bool isTypeOf(malType type) { \
+        return (type >= first) && (type <= last); \
+    } \
+
+// Hardly any values have metadata, so rather than every value carrying a
+// pointer to it, it lives in a side table keyed by the value's address.
+// A flag in the header says whether there is an entry to look up.
 class malValue : public RefCounted {
 public:
-    malValue() {
+    malValue(malType type) : m_type(type), m_hasMeta(false) {
         TRACE_OBJECT("Creating malValue %p\n", this);
     }
-    malValue(malValuePtr meta) : m_meta(meta) {
-        TRACE_OBJECT("Creating malValue %p\n", this);
-    }
-    virtual ~malValue() {
-        TRACE_OBJECT("Destroying malValue %p\n", this);
-    }
+    malValue(malType type, malValuePtr meta);
+    virtual ~malValue();
 
     malValuePtr withMeta(malValuePtr meta) const;
     virtual malValuePtr doWithMeta(malValuePtr meta) const = 0;
     malValuePtr meta() const;
 
-    bool isTrue() const;
-
     bool isEqualTo(const malValue* rhs) const;
 
-    virtual malValuePtr eval(malEnvPtr env);
+    // Values that are only equal to themselves hash their address.
+    virtual uint32_t hash() const;
+
+    virtual malValuePtr eval(malEnvRef env);
 
     virtual String print(bool readably) const = 0;
 
+    malType type() const { return m_type; }
+
+    static bool isTypeOf(malType type) { return true; }
+
+    virtual void visitReferences(ReferenceVisitor& visitor) const;
+
 protected:
     virtual bool doIsEqualTo(const malValue* rhs) const = 0;
 
-    malValuePtr m_meta;
+    // These fit in the padding after the refcount.
+    const malType m_type;
+    const bool    m_hasMeta;
 };
 
 template<class T>
-T* value_cast(malValuePtr obj, const char* typeName) {
-    T* dest = dynamic_cast<T*>(obj.ptr());
+T* dynamic_value_cast(const malValuePtr& obj) {
+    malValue* value = obj.ptr();
+    return ((value != NULL) && T::isTypeOf(value->type()))
+        ? static_cast<T*>(value) : NULL;
+}
+
+template<class T>
+T* value_cast(const malValuePtr& obj, const char* typeName) {
+    T* dest = dynamic_value_cast<T>(obj);
     MAL_CHECK(dest != NULL, "%s is not a %s",
               obj->print(true).c_str(), typeName);
     return dest;
 }
 
+// Integers are usually immediates, which can't be cast to malInteger.
+inline int64_t value_integer(const malValuePtr& obj) {
+    MAL_CHECK(obj.isInteger(), "%s is not a malInteger",
+              obj->print(true).c_str());
+    return obj.integerValue();
+}
+
 #define VALUE_CAST(Type, Value)    value_cast<Type>(Value, #Type)
-#define DYNAMIC_CAST(Type, Value)  (dynamic_cast<Type*>((Value).ptr()))
+#define DYNAMIC_CAST(Type, Value)  (dynamic_value_cast<Type>(Value))
 #define STATIC_CAST(Type, Value)   (static_cast<Type*>((Value).ptr()))
 
+template<class T> class InternTable;
+
 #define WITH_META(Type) \
     virtual malValuePtr doWithMeta(malValuePtr meta) const { \
         return new Type(*this, meta); \
     } \
 
+// nil, true and false are immediates, so a constant only needs an object
+// when it is given metadata.
 class malConstant : public malValue {
 public:
-    malConstant(String name) : m_name(name) { }
+    malConstant(const String& name, malValuePtr meta)
+        : malValue(TYPE_CONSTANT, meta), m_name(name) { }
     malConstant(const malConstant& that, malValuePtr meta)
-        : malValue(meta), m_name(that.m_name) { }
+        : malValue(TYPE_CONSTANT, meta), m_name(that.m_name) { }
+
+    VALUE_TYPE(TYPE_CONSTANT, TYPE_CONSTANT);
 
     virtual String print(bool readably) const { return m_name; }
 
     virtual bool doIsEqualTo(const malValue* rhs) const {
-        return this == rhs; // these are singletons
+        return this == rhs;
     }
 
     WITH_META(malConstant);
@@ -75,9 +131,13 @@ private:
 
 class malInteger : public malValue {
 public:
-    malInteger(int64_t value) : m_value(value) { }
+    malInteger(int64_t value) : malValue(TYPE_INTEGER), m_value(value) { }
+    malInteger(int64_t value, malValuePtr meta)
+        : malValue(TYPE_INTEGER, meta), m_value(value) { }
     malInteger(const malInteger& that, malValuePtr meta)
-        : malValue(meta), m_value(that.m_value) { }
+        : malValue(TYPE_INTEGER, meta), m_value(that.m_value) { }
+
+    VALUE_TYPE(TYPE_INTEGER, TYPE_INTEGER);
 
     virtual String print(bool readably) const {
         return std::to_string(m_value);
@@ -85,6 +145,8 @@ public:
 
     int64_t value() const { return m_value; }
 
+    virtual uint32_t hash() const;
+
     virtual bool doIsEqualTo(const malValue* rhs) const {
         return m_value == static_cast<const malInteger*>(rhs)->m_value;
     }
@@ -97,26 +159,41 @@ private:
 
 class malStringBase : public malValue {
 public:
-    malStringBase(const String& token)
-        : m_value(token) { }
+    malStringBase(malType type, const String& token)
+        : malValue(type), m_value(token), m_hash(0) { }
+    malStringBase(malType type, const char* begin, const char* end)
+        : malValue(type), m_value(begin, end), m_hash(0) { }
     malStringBase(const malStringBase& that, malValuePtr meta)
-        : malValue(meta), m_value(that.value()) { }
+        : malValue(that.type(), meta), m_value(that.value())
+        , m_hash(that.m_hash.load(std::memory_order_relaxed)) { }
+
+    VALUE_TYPE(TYPE_STRING, TYPE_SYMBOL);
 
     virtual String print(bool readably) const { return m_value; }
 
     String value() const { return m_value; }
 
+    virtual uint32_t hash() const;
+
 private:
     const String m_value;
+
+    // Worked out on first use, as most strings are never hashed. Keywords
+    // are shared between threads, hence the atomic. 0 means not yet.
+    mutable std::atomic<uint32_t> m_hash;
 };
 
 class malString : public malStringBase {
 public:
     malString(const String& token)
-        : malStringBase(token) { }
+        : malStringBase(TYPE_STRING, token) { }
+    malString(const char* begin, const char* end)
+        : malStringBase(TYPE_STRING, begin, end) { }
     malString(const malString& that, malValuePtr meta)
         : malStringBase(that, meta) { }
 
+    VALUE_TYPE(TYPE_STRING, TYPE_STRING);
+
     virtual String print(bool readably) const;
 
     String escapedValue() const;
@@ -130,52 +207,86 @@ public:
 
 class malKeyword : public malStringBase {
 public:
-    malKeyword(const String& token)
-        : malStringBase(token) { }
     malKeyword(const malKeyword& that, malValuePtr meta)
-        : malStringBase(that, meta) { }
+        : malStringBase(that, meta), m_id(that.m_id) { }
+
+    VALUE_TYPE(TYPE_KEYWORD, TYPE_KEYWORD);
+
+    // Keywords are interned, so all occurrences of a keyword share the
+    // same object and id.
+    static malKeyword* intern(const String& token);
+
+    int id() const { return m_id; }
 
     virtual bool doIsEqualTo(const malValue* rhs) const {
-        return value() == static_cast<const malKeyword*>(rhs)->value();
+        return m_id == static_cast<const malKeyword*>(rhs)->m_id;
     }
 
     WITH_META(malKeyword);
+
+private:
+    friend class InternTable<malKeyword>;
+    malKeyword(const String& token, int id)
+        : malStringBase(TYPE_KEYWORD, token), m_id(id) { }
+
+    const int m_id;
 };
 
 class malSymbol : public malStringBase {
 public:
-    malSymbol(const String& token)
-        : malStringBase(token) { }
     malSymbol(const malSymbol& that, malValuePtr meta)
-        : malStringBase(that, meta) { }
+        : malStringBase(that, meta), m_id(that.m_id) { }
+
+    VALUE_TYPE(TYPE_SYMBOL, TYPE_SYMBOL);
 
-    virtual malValuePtr eval(malEnvPtr env);
+    // Symbols are interned, so they can be compared and looked up in
+    // environments by id rather than by name.
+    static malSymbol* intern(const String& token);
+
+    int id() const { return m_id; }
+    bool is(const malSymbol* that) const { return m_id == that->m_id; }
+
+    virtual malValuePtr eval(malEnvRef env);
 
     virtual bool doIsEqualTo(const malValue* rhs) const {
-        return value() == static_cast<const malSymbol*>(rhs)->value();
+        return m_id == static_cast<const malSymbol*>(rhs)->m_id;
     }
 
     WITH_META(malSymbol);
+
+private:
+    friend class InternTable<malSymbol>;
+    malSymbol(const String& token, int id)
+        : malStringBase(TYPE_SYMBOL, token), m_id(id) { }
+
+    const int m_id;
 };
 
+// The items of a list or vector are stored straight after the object, in
+// the same allocation, so they can only be made through create(). A slice
+// made by drop(), rest() or with-meta has no items of its own: it points
+// into the storage of the sequence that has them, and holds a reference to
+// that sequence in its single inline slot.
 class malSequence : public malValue {
 public:
-    malSequence(malValueVec* items);
-    malSequence(malValueIter begin, malValueIter end);
-    malSequence(const malSequence& that, malValuePtr meta);
-    virtual ~malSequence();
+    VALUE_TYPE(TYPE_LIST, TYPE_VECTOR);
 
     virtual String print(bool readably) const;
 
-    malValueVec* evalItems(malEnvPtr env) const;
-    int count() const { return m_items->size(); }
-    bool isEmpty() const { return m_items->empty(); }
-    malValuePtr item(int index) const { return (*m_items)[index]; }
+    malValuePtr evalItems(malEnvRef env) const;
+    int count() const { return m_count; }
+    bool isEmpty() const { return m_count == 0; }
+    const malValuePtr& item(int index) const { return begin()[index]; }
 
-    malValueIter begin() const { return m_items->begin(); }
-    malValueIter end()   const { return m_items->end(); }
+    // Sequences are immutable, but the items of one that has just been
+    // made with an item count may be filled in through begin(). The only
+    // other writes are malVector::conj filling the spare slots at the end
+    // of its storage, which no sequence covers yet.
+    malValueIter begin() const { return m_items; }
+    malValueIter end() const { return m_items + m_count; }
 
     virtual bool doIsEqualTo(const malValue* rhs) const;
+    virtual uint32_t hash() const;
 
     virtual malValuePtr conj(malValueIter argsBegin,
                               malValueIter argsEnd) const = 0;
@@ -183,48 +294,126 @@ public:
     malValuePtr first() const;
     virtual malValuePtr rest() const;
 
+    virtual void visitReferences(ReferenceVisitor& visitor) const;
+    virtual void dropReferences();
+
+    // A list of the items from index n on, which shares this sequence's
+    // storage rather than copying it.
+    malValuePtr drop(int n) const;
+
+protected:
+    malSequence(malType type, int count);
+    malSequence(malType type,
+                const malValuePtr* begin, const malValuePtr* end);
+    malSequence(malType type, const malValuePtr& owner,
+                malValueIter begin, int count, malValuePtr meta);
+    virtual ~malSequence();
+
+    // T must add no members of its own, as the items start at the end of
+    // a malSequence. None of the constructors can throw.
+    template<class T, class... Args>
+    static T* create(int count, Args&&... args) {
+        static_assert(sizeof(T) == sizeof(malSequence),
+                      "sequence classes can't have members");
+        void* memory = allocate(allocationSize(count));
+        return ::new (memory) T(std::forward<Args>(args)...);
+    }
+
+    // A T holding the items from index start on, without copying them.
+    template<class T>
+    malValuePtr slice(int start, malValuePtr meta) const {
+        return malValuePtr(create<T>(1, storageOwner(), begin() + start,
+                                     m_count - start, std::move(meta)));
+    }
+
+    virtual void dispose() const;
+
+    bool isSlice() const { return m_items != inlineItems(); }
+    malValuePtr storageOwner() const;
+
 private:
-    malValueVec* const m_items;
+    static size_t allocationSize(int count) {
+        return sizeof(malSequence) + count * sizeof(malValuePtr);
+    }
+
+    malValuePtr* inlineItems() const {
+        return reinterpret_cast<malValuePtr*>(
+            const_cast<malSequence*>(this) + 1);
+    }
+
+    malValuePtr* const m_items;
+    const int m_count;
 };
 
 class malList : public malSequence {
 public:
-    malList(malValueVec* items) : malSequence(items) { }
-    malList(malValueIter begin, malValueIter end)
-        : malSequence(begin, end) { }
-    malList(const malList& that, malValuePtr meta)
-        : malSequence(that, meta) { }
+    static malList* create(int count) {
+        return malSequence::create<malList>(count, count);
+    }
+    static malList* create(const malValuePtr* begin, const malValuePtr* end) {
+        return malSequence::create<malList>(end - begin, begin, end);
+    }
+
+    VALUE_TYPE(TYPE_LIST, TYPE_LIST);
 
     virtual String print(bool readably) const;
-    virtual malValuePtr eval(malEnvPtr env);
+    virtual malValuePtr eval(malEnvRef env);
 
     virtual malValuePtr conj(malValueIter argsBegin,
                              malValueIter argsEnd) const;
 
-    WITH_META(malList);
+    virtual malValuePtr doWithMeta(malValuePtr meta) const {
+        return slice<malList>(0, meta);
+    }
+
+private:
+    friend class malSequence;
+    malList(int count) : malSequence(TYPE_LIST, count) { }
+    malList(const malValuePtr* begin, const malValuePtr* end)
+        : malSequence(TYPE_LIST, begin, end) { }
+    malList(const malValuePtr& owner, malValueIter begin, int count,
+            malValuePtr meta)
+        : malSequence(TYPE_LIST, owner, begin, count, meta) { }
 };
 
 class malVector : public malSequence {
 public:
-    malVector(malValueVec* items) : malSequence(items) { }
-    malVector(malValueIter begin, malValueIter end)
-        : malSequence(begin, end) { }
-    malVector(const malVector& that, malValuePtr meta)
-        : malSequence(that, meta) { }
+    static malVector* create(int count) {
+        return malSequence::create<malVector>(count, count);
+    }
+    static malVector* create(const malValuePtr* begin,
+                             const malValuePtr* end) {
+        return malSequence::create<malVector>(end - begin, begin, end);
+    }
+
+    VALUE_TYPE(TYPE_VECTOR, TYPE_VECTOR);
 
-    virtual malValuePtr eval(malEnvPtr env);
+    virtual malValuePtr eval(malEnvRef env);
     virtual String print(bool readably) const;
 
     virtual malValuePtr conj(malValueIter argsBegin,
                              malValueIter argsEnd) const;
 
-    WITH_META(malVector);
+    virtual malValuePtr doWithMeta(malValuePtr meta) const {
+        return slice<malVector>(0, meta);
+    }
+
+private:
+    friend class malSequence;
+    malVector(int count) : malSequence(TYPE_VECTOR, count) { }
+    malVector(const malValuePtr* begin, const malValuePtr* end)
+        : malSequence(TYPE_VECTOR, begin, end) { }
+    malVector(const malValuePtr& owner, malValueIter begin, int count,
+            malValuePtr meta)
+        : malSequence(TYPE_VECTOR, owner, begin, count, meta) { }
 };
 
 class malApplicable : public malValue {
 public:
-    malApplicable() { }
-    malApplicable(malValuePtr meta) : malValue(meta) { }
+    malApplicable(malType type) : malValue(type) { }
+    malApplicable(malType type, malValuePtr meta) : malValue(type, meta) { }
+
+    VALUE_TYPE(TYPE_BUILTIN, TYPE_LAMBDA);
 
     virtual malValuePtr apply(malValueIter argsBegin,
                                malValueIter argsEnd) const = 0;
@@ -232,17 +421,21 @@ public:
 
 class malHash : public malValue {
 public:
-    typedef std::map<String, malValuePtr> Map;
+    typedef HashTrie Map;
 
     malHash(malValueIter argsBegin, malValueIter argsEnd, bool isEvaluated);
     malHash(const malHash::Map& map);
+    // Shares the trie with the original.
     malHash(const malHash& that, malValuePtr meta)
-    : malValue(meta), m_map(that.m_map), m_isEvaluated(that.m_isEvaluated) { }
+    : malValue(TYPE_HASH, meta), m_map(that.m_map)
+    , m_isEvaluated(that.m_isEvaluated) { }
+
+    VALUE_TYPE(TYPE_HASH, TYPE_HASH);
 
     malValuePtr assoc(malValueIter argsBegin, malValueIter argsEnd) const;
     malValuePtr dissoc(malValueIter argsBegin, malValueIter argsEnd) const;
     bool contains(malValuePtr key) const;
-    malValuePtr eval(malEnvPtr env);
+    malValuePtr eval(malEnvRef env);
     malValuePtr get(malValuePtr key) const;
     malValuePtr keys() const;
     malValuePtr values() const;
@@ -250,6 +443,9 @@ public:
     virtual String print(bool readably) const;
 
     virtual bool doIsEqualTo(const malValue* rhs) const;
+    virtual uint32_t hash() const;
+
+    virtual void visitReferences(ReferenceVisitor& visitor) const;
 
     WITH_META(malHash);
 
@@ -258,6 +454,13 @@ private:
     const bool m_isEvaluated;
 };
 
+#if MAL_TRACING_GC
+inline void gcVisit(const malHash::Map& slot, ReferenceVisitor& visitor)
+{
+    slot.visit(visitor);
+}
+#endif
+
 class malBuiltIn : public malApplicable {
 public:
     typedef malValuePtr (ApplyFunc)(const String& name,
@@ -265,10 +468,13 @@ public:
                                     malValueIter argsEnd);
 
     malBuiltIn(const String& name, ApplyFunc* handler)
-    : m_name(name), m_handler(handler) { }
+    : malApplicable(TYPE_BUILTIN), m_name(name), m_handler(handler) { }
 
     malBuiltIn(const malBuiltIn& that, malValuePtr meta)
-    : malApplicable(meta), m_name(that.m_name), m_handler(that.m_handler) { }
+    : malApplicable(TYPE_BUILTIN, meta), m_name(that.m_name)
+    , m_handler(that.m_handler) { }
+
+    VALUE_TYPE(TYPE_BUILTIN, TYPE_BUILTIN);
 
     virtual malValuePtr apply(malValueIter argsBegin,
                               malValueIter argsEnd) const;
@@ -292,10 +498,13 @@ private:
 
 class malLambda : public malApplicable {
 public:
-    malLambda(const StringVec& bindings, malValuePtr body, malEnvPtr env);
+    malLambda(const malSymbolIdVec& bindings,
+              malValuePtr body, malEnvPtr env);
     malLambda(const malLambda& that, malValuePtr meta);
     malLambda(const malLambda& that, bool isMacro);
 
+    VALUE_TYPE(TYPE_LAMBDA, TYPE_LAMBDA);
+
     virtual malValuePtr apply(malValueIter argsBegin,
                               malValueIter argsEnd) const;
 
@@ -314,23 +523,36 @@ public:
 
     virtual malValuePtr doWithMeta(malValuePtr meta) const;
 
+    virtual void visitReferences(ReferenceVisitor& visitor) const;
+
 private:
-    const StringVec   m_bindings;
-    const malValuePtr m_body;
-    const malEnvPtr   m_env;
-    const bool        m_isMacro;
+    const malSymbolIdVec m_bindings;
+    const malValuePtr    m_body;
+    const malEnvPtr      m_env;
+    const bool           m_isMacro;
 };
 
 class malAtom : public malValue {
 public:
-    malAtom(malValuePtr value) : m_value(value) { }
+    malAtom(malValuePtr value) : malValue(TYPE_ATOM), m_value(value) {
+        makeCycleCandidate();
+    }
     malAtom(const malAtom& that, malValuePtr meta)
-        : malValue(meta), m_value(that.m_value) { }
+        : malValue(TYPE_ATOM, meta), m_value(that.m_value) {
+        makeCycleCandidate();
+    }
+
+    VALUE_TYPE(TYPE_ATOM, TYPE_ATOM);
 
     virtual bool doIsEqualTo(const malValue* rhs) const {
-        return this->m_value->isEqualTo(rhs);
+        const malValue* value = m_value.ptr();
+        return (value != NULL) && value->isEqualTo(rhs);
     }
 
+    // Equality depends on the contents, which can change, so every atom
+    // hashes the same.
+    virtual uint32_t hash() const { return TYPE_ATOM; }
+
     virtual String print(bool readably) const {
         return "(atom " + m_value->print(readably) + ")";
     };
@@ -339,6 +561,13 @@ public:
 
     malValuePtr reset(malValuePtr value) { return m_value = value; }
 
+    virtual void visitReferences(ReferenceVisitor& visitor) const {
+        malValue::visitReferences(visitor);
+        m_value.visit(visitor);
+    }
+
+    virtual void dropReferences() { m_value = malValuePtr::nil(); }
+
     WITH_META(malAtom);
 
 private:
@@ -347,28 +576,75 @@ private:
 
 namespace mal {
     malValuePtr atom(malValuePtr value);
-    malValuePtr boolean(bool value);
     malValuePtr builtin(const String& name, malBuiltIn::ApplyFunc handler);
-    malValuePtr falseValue();
     malValuePtr hash(malValueIter argsBegin, malValueIter argsEnd,
                      bool isEvaluated);
     malValuePtr hash(const malHash::Map& map);
-    malValuePtr integer(int64_t value);
-    malValuePtr integer(const String& token);
     malValuePtr keyword(const String& token);
-    malValuePtr lambda(const StringVec&, malValuePtr, malEnvPtr);
-    malValuePtr list(malValueVec* items);
+    malValuePtr lambda(const malSymbolIdVec&, malValuePtr, malEnvPtr);
     malValuePtr list(malValueIter begin, malValueIter end);
+    malValuePtr list(const malValueVec& items);
     malValuePtr list(malValuePtr a);
     malValuePtr list(malValuePtr a, malValuePtr b);
     malValuePtr list(malValuePtr a, malValuePtr b, malValuePtr c);
     malValuePtr macro(const malLambda& lambda);
-    malValuePtr nilValue();
     malValuePtr string(const String& token);
+    malValuePtr string(const char* begin, const char* end);
     malValuePtr symbol(const String& token);
-    malValuePtr trueValue();
-    malValuePtr vector(malValueVec* items);
     malValuePtr vector(malValueIter begin, malValueIter end);
+    malValuePtr vector(const malValueVec& items);
+
+    // These are immediates, so they never allocate.
+    inline malValuePtr boolean(bool value) {
+        return value ? malValuePtr::trueValue() : malValuePtr::falseValue();
+    }
+    inline malValuePtr falseValue() { return malValuePtr::falseValue(); }
+    inline malValuePtr integer(int64_t value) {
+        return malValuePtr::integer(value);
+    }
+    inline malValuePtr nilValue()   { return malValuePtr::nil(); }
+    inline malValuePtr trueValue()  { return malValuePtr::trueValue(); }
 };
 
+inline malValuePtr::malValuePtr(malValue* object)
+: m_bits(reinterpret_cast<uintptr_t>(static_cast<RefCounted*>(object)))
+{
+    adopt();
+}
+
+inline malValue* malValuePtr::ptr() const
+{
+    return isObject()
+        ? static_cast<malValue*>(const_cast<RefCounted*>(object()))
+        : NULL;
+}
+
+inline malValuePtr malValuePtr::integer(int64_t value)
+{
+    // Anything that doesn't fit in the bits left after the tag is boxed.
+    if ((value >= INTPTR_MIN / 2) && (value <= INTPTR_MAX / 2)) {
+        return malValuePtr((static_cast<uintptr_t>(value) << 1) | integerTag);
+    }
+    return malValuePtr(new malInteger(value));
+}
+
+inline bool malValuePtr::isInteger() const
+{
+    return isImmediateInteger()
+        || (isObject() && (ptr()->type() == TYPE_INTEGER));
+}
+
+inline int64_t malValuePtr::integerValue() const
+{
+    if (isImmediateInteger()) {
+        return static_cast<intptr_t>(m_bits) >> 1;
+    }
+    return static_cast<const malInteger*>(ptr())->value();
+}
+
+inline malValuePtr malValuePtr::meta() const
+{
+    return isObject() ? ptr()->meta() : nil();
+}
+
 #endif // INCLUDE_TYPES_H
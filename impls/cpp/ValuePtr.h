@@ -0,0 +1,180 @@
+#ifndef INCLUDE_VALUEPTR_H
+#define INCLUDE_VALUEPTR_H
+
+#include "RefCountedPtr.h"
+#include "String.h"
+
+#include <stdint.h>
+
+class malValue;
+class malEnv;
+typedef RefCountedPtr<malEnv> malEnvPtr;
+typedef BorrowedPtr<malEnv>   malEnvRef;
+
+// A reference to a mal value. Most values are refcounted malValue objects,
+// but integers that fit in a pointer less one bit, and nil, true and false,
+// are immediates encoded in the pointer itself. They are never allocated,
+// and copying them never touches a refcount.
+//
+// The operations every value supports are on the pointer, and operator->
+// returns the pointer itself, so value->print(true) works for any kind of
+// value. Code that needs a particular class still uses ptr(), which is
+// NULL for immediates, so use isInteger() rather than casting to
+// malInteger.
+//
+// The methods are defined in Types.h, as they need the full malValue.
+class malValuePtr {
+public:
+    malValuePtr() : m_bits(0) { }
+    malValuePtr(malValue* object);
+    malValuePtr(const malValuePtr& rhs) : m_bits(rhs.m_bits) { acquire(); }
+    malValuePtr(malValuePtr&& rhs) : m_bits(rhs.m_bits) { rhs.m_bits = 0; }
+    ~malValuePtr() { release(); }
+
+    const malValuePtr& operator = (const malValuePtr& rhs) {
+        rhs.acquire();
+        release();
+        m_bits = rhs.m_bits;
+        return *this;
+    }
+
+    const malValuePtr& operator = (malValuePtr&& rhs) {
+        if (this != &rhs) {
+            release();
+            m_bits = rhs.m_bits;
+            rhs.m_bits = 0;
+        }
+        return *this;
+    }
+
+    bool operator == (const malValuePtr& rhs) const {
+        return m_bits == rhs.m_bits;
+    }
+
+    bool operator != (const malValuePtr& rhs) const {
+        return m_bits != rhs.m_bits;
+    }
+
+    operator bool () const {
+        return m_bits != 0;
+    }
+
+    const malValuePtr* operator -> () const { return this; }
+    malValue* ptr() const;
+
+    static malValuePtr integer(int64_t value);
+    static malValuePtr nil()        { return malValuePtr(nilBits); }
+    static malValuePtr trueValue()  { return malValuePtr(trueBits); }
+    static malValuePtr falseValue() { return malValuePtr(falseBits); }
+
+    bool isImmediateInteger() const { return (m_bits & integerTag) != 0; }
+    bool isInteger() const;
+    int64_t integerValue() const;
+
+    malValuePtr eval(malEnvRef env) const;
+    bool isEqualTo(const malValuePtr& rhs) const;
+    uint32_t hash() const;  // equal values have equal hashes
+    bool isTrue() const {
+        return (m_bits != nilBits) && (m_bits != falseBits);
+    }
+    malValuePtr meta() const;
+    String print(bool readably) const;
+    malValuePtr withMeta(malValuePtr meta) const;
+
+    void visit(ReferenceVisitor& visitor) const {
+        if (isObject()) {
+            visitor.visit(object());
+        }
+    }
+
+private:
+    friend class malValueRef;
+
+    // Objects are at least 8-byte aligned, so the low three bits of an
+    // object pointer are clear. Integers set the lowest bit, and the
+    // constants are the small even values that can't be pointers.
+    static const uintptr_t integerTag   = 1;
+    static const uintptr_t nilBits      = 2;
+    static const uintptr_t falseBits    = 4;
+    static const uintptr_t trueBits     = 6;
+    static const uintptr_t immediateMask = 7;
+
+    explicit malValuePtr(uintptr_t bits) : m_bits(bits) { }
+
+    bool isObject() const {
+        return (m_bits != 0) && ((m_bits & immediateMask) == 0);
+    }
+
+    // Object pointers are held as RefCounted, so that refcounting doesn't
+    // need the full malValue.
+    const RefCounted* object() const {
+        return reinterpret_cast<const RefCounted*>(m_bits);
+    }
+
+    void acquire() const {
+        if (isObject()) {
+            object()->acquire();
+        }
+    }
+
+    void adopt() const {
+        if (isObject()) {
+            object()->adopt();
+        }
+    }
+
+    void release() const {
+        if (isObject() && (object()->release() == 0)) {
+            object()->destroy();
+        }
+    }
+
+    uintptr_t m_bits;
+};
+
+// A value that something else owns, for parameters and locals that only
+// look at it. Copying one never touches a refcount. It can be used
+// wherever a const malValuePtr& is expected, and copying it into a
+// malValuePtr takes a reference, for when the value has to be kept.
+class malValueRef {
+public:
+    malValueRef() : m_value() { }
+    malValueRef(const malValuePtr& owner) : m_value(owner.m_bits) { }
+    malValueRef(const malValueRef& rhs) : m_value(rhs.m_value.m_bits) { }
+    ~malValueRef() { } // m_value isn't ours to release
+
+    malValueRef& operator = (const malValueRef& rhs) {
+        m_value.m_bits = rhs.m_value.m_bits;
+        return *this;
+    }
+
+    malValueRef& operator = (const malValuePtr& owner) {
+        m_value.m_bits = owner.m_bits;
+        return *this;
+    }
+
+    // Borrowing from a temporary would leave the value dangling once the
+    // temporary has gone.
+    malValueRef& operator = (malValuePtr&&) = delete;
+
+    operator const malValuePtr& () const { return m_value; }
+
+    const malValuePtr* operator -> () const { return &m_value; }
+    malValue* ptr() const { return m_value.ptr(); }
+
+private:
+    // A union member is never destroyed, so the malValuePtr can share the
+    // caller's reference without giving it up.
+    union {
+        malValuePtr m_value;
+    };
+};
+
+#if MAL_TRACING_GC
+inline void gcVisit(const malValuePtr& slot, ReferenceVisitor& visitor)
+{
+    slot.visit(visitor);
+}
+#endif
+
+#endif // INCLUDE_VALUEPTR_H
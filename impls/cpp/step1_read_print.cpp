@@ -36,6 +36,8 @@ int main(int argc, char* argv[])
 
 static String rep(const String& input)
 {
+    // Nothing is held between lines, so this is the only safe point.
+    GC_SAFE_POINT();
     return PRINT(EVAL(READ(input)));
 }
 
@@ -55,12 +57,12 @@ String PRINT(malValuePtr ast)
 }
 
 // These have been added after step 1 to keep the linker happy.
-malValuePtr EVAL(malValuePtr ast, malEnvPtr)
+malValuePtr EVAL(malValueRef ast, malEnvRef)
 {
     return ast;
 }
 
-malValuePtr APPLY(malValuePtr ast, malValueIter, malValueIter)
+malValuePtr APPLY(malValueRef ast, malValueIter, malValueIter)
 {
     return ast;
 }
@@ -19,6 +19,7 @@ int main(int argc, char* argv[])
     String prompt = "user> ";
     String input;
     malEnvPtr replEnv(new malEnv);
+    GC_ROOT(replEnv);
     replEnv->set("+", mal::builtin("+", &builtIn_add));
     replEnv->set("-", mal::builtin("-", &builtIn_sub));
     replEnv->set("*", mal::builtin("+", &builtIn_mul));
@@ -49,9 +50,12 @@ malValuePtr READ(const String& input)
     return readStr(input);
 }
 
-malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
+malValuePtr EVAL(malValueRef ast, malEnvRef env)
 {
     // std::cout << "EVAL: " << PRINT(ast) << "\n";
+    GC_ROOT(ast);
+    GC_ROOT(env);
+    GC_SAFE_POINT();
 
     return ast->eval(env);
 }
@@ -61,7 +65,7 @@ String PRINT(malValuePtr ast)
     return ast->print(true);
 }
 
-malValuePtr APPLY(malValuePtr op, malValueIter argsBegin, malValueIter argsEnd)
+malValuePtr APPLY(malValueRef op, malValueIter argsBegin, malValueIter argsEnd)
 {
     const malApplicable* handler = DYNAMIC_CAST(malApplicable, op);
     MAL_CHECK(handler != NULL,
@@ -71,6 +75,7 @@ malValuePtr APPLY(malValuePtr op, malValueIter argsBegin, malValueIter argsEnd)
 }
 
 #define ARG(type, name) type* name = VALUE_CAST(type, *argsBegin++)
+#define ARG_INTEGER(name) int64_t name = value_integer(*argsBegin++)
 
 #define CHECK_ARGS_IS(expected) \
     checkArgsIs(name.c_str(), expected, std::distance(argsBegin, argsEnd))
@@ -83,38 +88,38 @@ static malValuePtr builtIn_add(const String& name,
     malValueIter argsBegin, malValueIter argsEnd)
 {
         CHECK_ARGS_IS(2);
-        ARG(malInteger, lhs);
-        ARG(malInteger, rhs);
-        return mal::integer(lhs->value() + rhs->value());
+        ARG_INTEGER(lhs);
+        ARG_INTEGER(rhs);
+        return mal::integer(lhs + rhs);
 }
 
 static malValuePtr builtIn_sub(const String& name,
     malValueIter argsBegin, malValueIter argsEnd)
 {
         int argCount = CHECK_ARGS_BETWEEN(1, 2);
-        ARG(malInteger, lhs);
+        ARG_INTEGER(lhs);
         if (argCount == 1) {
-            return mal::integer(- lhs->value());
+            return mal::integer(- lhs);
         }
-        ARG(malInteger, rhs);
-        return mal::integer(lhs->value() - rhs->value());
+        ARG_INTEGER(rhs);
+        return mal::integer(lhs - rhs);
 }
 
 static malValuePtr builtIn_mul(const String& name,
     malValueIter argsBegin, malValueIter argsEnd)
 {
         CHECK_ARGS_IS(2);
-        ARG(malInteger, lhs);
-        ARG(malInteger, rhs);
-        return mal::integer(lhs->value() * rhs->value());
+        ARG_INTEGER(lhs);
+        ARG_INTEGER(rhs);
+        return mal::integer(lhs * rhs);
 }
 
 static malValuePtr builtIn_div(const String& name,
     malValueIter argsBegin, malValueIter argsEnd)
 {
         CHECK_ARGS_IS(2);
-        ARG(malInteger, lhs);
-        ARG(malInteger, rhs);
-        MAL_CHECK(rhs->value() != 0, "Division by zero"); \
-        return mal::integer(lhs->value() / rhs->value());
+        ARG_INTEGER(lhs);
+        ARG_INTEGER(rhs);
+        MAL_CHECK(rhs != 0, "Division by zero"); \
+        return mal::integer(lhs / rhs);
 }
@@ -13,6 +13,12 @@ String PRINT(malValuePtr ast);
 static ReadLine s_readLine("~/.mal-history");
 
 static malEnvPtr replEnv(new malEnv);
+GC_ROOT(replEnv);
+
+// Symbols are interned, so the special forms can be recognised by id.
+static const malSymbol* const s_debugEval = malSymbol::intern("DEBUG-EVAL");
+static const malSymbol* const s_def       = malSymbol::intern("def!");
+static const malSymbol* const s_let       = malSymbol::intern("let*");
 
 int main(int argc, char* argv[])
 {
@@ -45,14 +51,18 @@ malValuePtr READ(const String& input)
     return readStr(input);
 }
 
-malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
+malValuePtr EVAL(malValueRef ast, malEnvRef env)
 {
+    GC_ROOT(ast);
+    GC_ROOT(env);
+    GC_SAFE_POINT();
+
     if (!env) {
         env = replEnv;
     }
 
-    const malEnvPtr dbgenv = env->find("DEBUG-EVAL");
-    if (dbgenv && dbgenv->get("DEBUG-EVAL")->isTrue()) {
+    const malEnvPtr dbgenv = env->find(s_debugEval);
+    if (dbgenv && dbgenv->get(s_debugEval)->isTrue()) {
         std::cout << "EVAL: " << PRINT(ast) << "\n";
     }
 
@@ -64,33 +74,35 @@ malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
     // From here on down we are evaluating a non-empty list.
     // First handle the special forms.
     if (const malSymbol* symbol = DYNAMIC_CAST(malSymbol, list->item(0))) {
-        String special = symbol->value();
         int argCount = list->count() - 1;
 
-        if (special == "def!") {
+        if (symbol->is(s_def)) {
             checkArgsIs("def!", 2, argCount);
             const malSymbol* id = VALUE_CAST(malSymbol, list->item(1));
-            return env->set(id->value(), EVAL(list->item(2), env));
+            return env->set(id, EVAL(list->item(2), env));
         }
 
-        if (special == "let*") {
+        if (symbol->is(s_let)) {
             checkArgsIs("let*", 2, argCount);
             const malSequence* bindings =
                 VALUE_CAST(malSequence, list->item(1));
             int count = checkArgsEven("let*", bindings->count());
             malEnvPtr inner(new malEnv(env));
+            GC_ROOT(inner);
             for (int i = 0; i < count; i += 2) {
                 const malSymbol* var =
                     VALUE_CAST(malSymbol, bindings->item(i));
-                inner->set(var->value(), EVAL(bindings->item(i+1), inner));
+                inner->set(var, EVAL(bindings->item(i+1), inner));
             }
             return EVAL(list->item(2), inner);
         }
     }
 
     // Now we're left with the case of a regular list to be evaluated.
-    std::unique_ptr<malValueVec> items(list->evalItems(env));
-    malValuePtr op = items->at(0);
+    malValuePtr evaluated = list->evalItems(env);
+    GC_ROOT(evaluated);
+    const malList* items = STATIC_CAST(malList, evaluated);
+    malValuePtr op = items->item(0);
     return APPLY(op, items->begin()+1, items->end());
 }
 
@@ -99,7 +111,7 @@ String PRINT(malValuePtr ast)
     return ast->print(true);
 }
 
-malValuePtr APPLY(malValuePtr op, malValueIter argsBegin, malValueIter argsEnd)
+malValuePtr APPLY(malValueRef op, malValueIter argsBegin, malValueIter argsEnd)
 {
     const malApplicable* handler = DYNAMIC_CAST(malApplicable, op);
     MAL_CHECK(handler != NULL,
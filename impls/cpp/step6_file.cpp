@@ -17,6 +17,15 @@ static String safeRep(const String& input, malEnvPtr env);
 static ReadLine s_readLine("~/.mal-history");
 
 static malEnvPtr replEnv(new malEnv);
+GC_ROOT(replEnv);
+
+// Symbols are interned, so the special forms can be recognised by id.
+static const malSymbol* const s_debugEval = malSymbol::intern("DEBUG-EVAL");
+static const malSymbol* const s_def       = malSymbol::intern("def!");
+static const malSymbol* const s_do        = malSymbol::intern("do");
+static const malSymbol* const s_fn        = malSymbol::intern("fn*");
+static const malSymbol* const s_if        = malSymbol::intern("if");
+static const malSymbol* const s_let       = malSymbol::intern("let*");
 
 int main(int argc, char* argv[])
 {
@@ -53,9 +62,9 @@ static String safeRep(const String& input, malEnvPtr env)
 
 static void makeArgv(malEnvPtr env, int argc, char* argv[])
 {
-    malValueVec* args = new malValueVec();
+    malValueVec args;
     for (int i = 0; i < argc; i++) {
-        args->push_back(mal::string(argv[i]));
+        args.push_back(mal::string(argv[i]));
     }
     env->set("*ARGV*", mal::list(args));
 }
@@ -70,15 +79,25 @@ malValuePtr READ(const String& input)
     return readStr(input);
 }
 
-malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
+malValuePtr EVAL(malValueRef ast, malEnvRef env)
 {
+    // ast and env are borrowed from the caller. A tail call that moves on
+    // to something the caller doesn't own keeps it alive in these.
+    malValuePtr astOwner;
+    malEnvPtr   envOwner;
+    GC_ROOT(ast);
+    GC_ROOT(env);
+    GC_ROOT(astOwner);
+    GC_ROOT(envOwner);
+
     if (!env) {
         env = replEnv;
     }
     while (1) {
+        GC_SAFE_POINT();
 
-       const malEnvPtr dbgenv = env->find("DEBUG-EVAL");
-       if (dbgenv && dbgenv->get("DEBUG-EVAL")->isTrue()) {
+       const malEnvPtr dbgenv = env->find(s_debugEval);
+       if (dbgenv && dbgenv->get(s_debugEval)->isTrue()) {
            std::cout << "EVAL: " << PRINT(ast) << "\n";
        }
 
@@ -90,16 +109,15 @@ malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
         // From here on down we are evaluating a non-empty list.
         // First handle the special forms.
         if (const malSymbol* symbol = DYNAMIC_CAST(malSymbol, list->item(0))) {
-            String special = symbol->value();
             int argCount = list->count() - 1;
 
-            if (special == "def!") {
+            if (symbol->is(s_def)) {
                 checkArgsIs("def!", 2, argCount);
                 const malSymbol* id = VALUE_CAST(malSymbol, list->item(1));
-                return env->set(id->value(), EVAL(list->item(2), env));
+                return env->set(id, EVAL(list->item(2), env));
             }
 
-            if (special == "do") {
+            if (symbol->is(s_do)) {
                 checkArgsAtLeast("do", 1, argCount);
 
                 for (int i = 1; i < argCount; i++) {
@@ -109,22 +127,22 @@ malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
                 continue; // TCO
             }
 
-            if (special == "fn*") {
+            if (symbol->is(s_fn)) {
                 checkArgsIs("fn*", 2, argCount);
 
                 const malSequence* bindings =
                     VALUE_CAST(malSequence, list->item(1));
-                StringVec params;
+                malSymbolIdVec params;
                 for (int i = 0; i < bindings->count(); i++) {
                     const malSymbol* sym =
                         VALUE_CAST(malSymbol, bindings->item(i));
-                    params.push_back(sym->value());
+                    params.push_back(sym->id());
                 }
 
                 return mal::lambda(params, list->item(2), env);
             }
 
-            if (special == "if") {
+            if (symbol->is(s_if)) {
                 checkArgsBetween("if", 2, 3, argCount);
 
                 bool isTrue = EVAL(list->item(1), env)->isTrue();
@@ -135,29 +153,35 @@ malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
                 continue; // TCO
             }
 
-            if (special == "let*") {
+            if (symbol->is(s_let)) {
                 checkArgsIs("let*", 2, argCount);
                 const malSequence* bindings =
                     VALUE_CAST(malSequence, list->item(1));
                 int count = checkArgsEven("let*", bindings->count());
                 malEnvPtr inner(new malEnv(env));
+                GC_ROOT(inner);
                 for (int i = 0; i < count; i += 2) {
                     const malSymbol* var =
                         VALUE_CAST(malSymbol, bindings->item(i));
-                    inner->set(var->value(), EVAL(bindings->item(i+1), inner));
+                    inner->set(var, EVAL(bindings->item(i+1), inner));
                 }
                 ast = list->item(2);
-                env = inner;
+                envOwner = std::move(inner);
+                env = envOwner;
                 continue; // TCO
             }
         }
 
         // Now we're left with the case of a regular list to be evaluated.
-        std::unique_ptr<malValueVec> items(list->evalItems(env));
-        malValuePtr op = items->at(0);
+        malValuePtr evaluated = list->evalItems(env);
+        GC_ROOT(evaluated);
+        const malList* items = STATIC_CAST(malList, evaluated);
+        malValuePtr op = items->item(0);
         if (const malLambda* lambda = DYNAMIC_CAST(malLambda, op)) {
-            ast = lambda->getBody();
-            env = lambda->makeEnv(items->begin()+1, items->end());
+            astOwner = lambda->getBody();
+            envOwner = lambda->makeEnv(items->begin()+1, items->end());
+            ast = astOwner;
+            env = envOwner;
             continue; // TCO
         }
         else {
@@ -171,7 +195,7 @@ String PRINT(malValuePtr ast)
     return ast->print(true);
 }
 
-malValuePtr APPLY(malValuePtr op, malValueIter argsBegin, malValueIter argsEnd)
+malValuePtr APPLY(malValueRef op, malValueIter argsBegin, malValueIter argsEnd)
 {
     const malApplicable* handler = DYNAMIC_CAST(malApplicable, op);
     MAL_CHECK(handler != NULL,
@@ -182,8 +206,6 @@ malValuePtr APPLY(malValuePtr op, malValueIter argsBegin, malValueIter argsEnd)
 
 static const char* malFunctionTable[] = {
     "(def! not (fn* (cond) (if cond false true)))",
-    "(def! load-file (fn* (filename) \
-        (eval (read-string (str \"(do \" (slurp filename) \"\nnil)\")))))",
 };
 
 static void installFunctions(malEnvPtr env) {
@@ -19,6 +19,21 @@ static malValuePtr quasiquote(malValuePtr obj);
 static ReadLine s_readLine("~/.mal-history");
 
 static malEnvPtr replEnv(new malEnv);
+GC_ROOT(replEnv);
+
+// Symbols are interned, so the special forms can be recognised by id.
+static const malSymbol* const s_debugEval     = malSymbol::intern("DEBUG-EVAL");
+static const malSymbol* const s_def           = malSymbol::intern("def!");
+static const malSymbol* const s_defmacro      = malSymbol::intern("defmacro!");
+static const malSymbol* const s_do            = malSymbol::intern("do");
+static const malSymbol* const s_fn            = malSymbol::intern("fn*");
+static const malSymbol* const s_if            = malSymbol::intern("if");
+static const malSymbol* const s_let           = malSymbol::intern("let*");
+static const malSymbol* const s_quasiquote    = malSymbol::intern("quasiquote");
+static const malSymbol* const s_quote         = malSymbol::intern("quote");
+static const malSymbol* const s_unquote       = malSymbol::intern("unquote");
+static const malSymbol* const s_spliceUnquote =
+    malSymbol::intern("splice-unquote");
 
 int main(int argc, char* argv[])
 {
@@ -55,9 +70,9 @@ static String safeRep(const String& input, malEnvPtr env)
 
 static void makeArgv(malEnvPtr env, int argc, char* argv[])
 {
-    malValueVec* args = new malValueVec();
+    malValueVec args;
     for (int i = 0; i < argc; i++) {
-        args->push_back(mal::string(argv[i]));
+        args.push_back(mal::string(argv[i]));
     }
     env->set("*ARGV*", mal::list(args));
 }
@@ -72,15 +87,25 @@ malValuePtr READ(const String& input)
     return readStr(input);
 }
 
-malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
+malValuePtr EVAL(malValueRef ast, malEnvRef env)
 {
+    // ast and env are borrowed from the caller. A tail call that moves on
+    // to something the caller doesn't own keeps it alive in these.
+    malValuePtr astOwner;
+    malEnvPtr   envOwner;
+    GC_ROOT(ast);
+    GC_ROOT(env);
+    GC_ROOT(astOwner);
+    GC_ROOT(envOwner);
+
     if (!env) {
         env = replEnv;
     }
     while (1) {
+        GC_SAFE_POINT();
 
-       const malEnvPtr dbgenv = env->find("DEBUG-EVAL");
-       if (dbgenv && dbgenv->get("DEBUG-EVAL")->isTrue()) {
+       const malEnvPtr dbgenv = env->find(s_debugEval);
+       if (dbgenv && dbgenv->get(s_debugEval)->isTrue()) {
            std::cout << "EVAL: " << PRINT(ast) << "\n";
        }
 
@@ -92,25 +117,24 @@ malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
         // From here on down we are evaluating a non-empty list.
         // First handle the special forms.
         if (const malSymbol* symbol = DYNAMIC_CAST(malSymbol, list->item(0))) {
-            String special = symbol->value();
             int argCount = list->count() - 1;
 
-            if (special == "def!") {
+            if (symbol->is(s_def)) {
                 checkArgsIs("def!", 2, argCount);
                 const malSymbol* id = VALUE_CAST(malSymbol, list->item(1));
-                return env->set(id->value(), EVAL(list->item(2), env));
+                return env->set(id, EVAL(list->item(2), env));
             }
 
-            if (special == "defmacro!") {
+            if (symbol->is(s_defmacro)) {
                 checkArgsIs("defmacro!", 2, argCount);
 
                 const malSymbol* id = VALUE_CAST(malSymbol, list->item(1));
                 malValuePtr body = EVAL(list->item(2), env);
                 const malLambda* lambda = VALUE_CAST(malLambda, body);
-                return env->set(id->value(), mal::macro(*lambda));
+                return env->set(id, mal::macro(*lambda));
             }
 
-            if (special == "do") {
+            if (symbol->is(s_do)) {
                 checkArgsAtLeast("do", 1, argCount);
 
                 for (int i = 1; i < argCount; i++) {
@@ -120,22 +144,22 @@ malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
                 continue; // TCO
             }
 
-            if (special == "fn*") {
+            if (symbol->is(s_fn)) {
                 checkArgsIs("fn*", 2, argCount);
 
                 const malSequence* bindings =
                     VALUE_CAST(malSequence, list->item(1));
-                StringVec params;
+                malSymbolIdVec params;
                 for (int i = 0; i < bindings->count(); i++) {
                     const malSymbol* sym =
                         VALUE_CAST(malSymbol, bindings->item(i));
-                    params.push_back(sym->value());
+                    params.push_back(sym->id());
                 }
 
                 return mal::lambda(params, list->item(2), env);
             }
 
-            if (special == "if") {
+            if (symbol->is(s_if)) {
                 checkArgsBetween("if", 2, 3, argCount);
 
                 bool isTrue = EVAL(list->item(1), env)->isTrue();
@@ -146,29 +170,32 @@ malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
                 continue; // TCO
             }
 
-            if (special == "let*") {
+            if (symbol->is(s_let)) {
                 checkArgsIs("let*", 2, argCount);
                 const malSequence* bindings =
                     VALUE_CAST(malSequence, list->item(1));
                 int count = checkArgsEven("let*", bindings->count());
                 malEnvPtr inner(new malEnv(env));
+                GC_ROOT(inner);
                 for (int i = 0; i < count; i += 2) {
                     const malSymbol* var =
                         VALUE_CAST(malSymbol, bindings->item(i));
-                    inner->set(var->value(), EVAL(bindings->item(i+1), inner));
+                    inner->set(var, EVAL(bindings->item(i+1), inner));
                 }
                 ast = list->item(2);
-                env = inner;
+                envOwner = std::move(inner);
+                env = envOwner;
                 continue; // TCO
             }
 
-            if (special == "quasiquote") {
+            if (symbol->is(s_quasiquote)) {
                 checkArgsIs("quasiquote", 1, argCount);
-                ast = quasiquote(list->item(1));
+                astOwner = quasiquote(list->item(1));
+                ast = astOwner;
                 continue; // TCO
             }
 
-            if (special == "quote") {
+            if (symbol->is(s_quote)) {
                 checkArgsIs("quote", 1, argCount);
                 return list->item(1);
             }
@@ -176,18 +203,28 @@ malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
 
         // Now we're left with the case of a regular list to be evaluated.
         malValuePtr op = EVAL(list->item(0), env);
+        GC_ROOT(op);
         if (const malLambda* lambda = DYNAMIC_CAST(malLambda, op)) {
             if (lambda->isMacro()) {
-                ast = lambda->apply(list->begin()+1, list->end());
+                astOwner = lambda->apply(list->begin()+1, list->end());
+                ast = astOwner;
                 continue; // TCO
             }
-            malValueVec* items = STATIC_CAST(malList, list->rest())->evalItems(env);
-            ast = lambda->getBody();
-            env = lambda->makeEnv(items->begin(), items->end());
+            malValuePtr evaluated =
+                STATIC_CAST(malList, list->rest())->evalItems(env);
+            GC_ROOT(evaluated);
+            const malList* items = STATIC_CAST(malList, evaluated);
+            astOwner = lambda->getBody();
+            envOwner = lambda->makeEnv(items->begin(), items->end());
+            ast = astOwner;
+            env = envOwner;
             continue; // TCO
         }
         else {
-            malValueVec* items = STATIC_CAST(malList, list->rest())->evalItems(env);
+            malValuePtr evaluated =
+                STATIC_CAST(malList, list->rest())->evalItems(env);
+            GC_ROOT(evaluated);
+            const malList* items = STATIC_CAST(malList, evaluated);
             return APPLY(op, items->begin(), items->end());
         }
     }
@@ -198,7 +235,7 @@ String PRINT(malValuePtr ast)
     return ast->print(true);
 }
 
-malValuePtr APPLY(malValuePtr op, malValueIter argsBegin, malValueIter argsEnd)
+malValuePtr APPLY(malValueRef op, malValueIter argsBegin, malValueIter argsEnd)
 {
     const malApplicable* handler = DYNAMIC_CAST(malApplicable, op);
     MAL_CHECK(handler != NULL,
@@ -207,19 +244,19 @@ malValuePtr APPLY(malValuePtr op, malValueIter argsBegin, malValueIter argsEnd)
     return handler->apply(argsBegin, argsEnd);
 }
 
-static bool isSymbol(malValuePtr obj, const String& text)
+static bool isSymbol(malValuePtr obj, const malSymbol* symbol)
 {
     const malSymbol* sym = DYNAMIC_CAST(malSymbol, obj);
-    return sym && (sym->value() == text);
+    return sym && sym->is(symbol);
 }
 
 //  Return arg when ast matches ('sym, arg), else NULL.
-static malValuePtr starts_with(const malValuePtr ast, const char* sym)
+static malValuePtr starts_with(const malValuePtr ast, const malSymbol* sym)
 {
     const malList* list = DYNAMIC_CAST(malList, ast);
     if (!list || list->isEmpty() || !isSymbol(list->item(0), sym))
         return NULL;
-    checkArgsIs(sym, 1, list->count() - 1);
+    checkArgsIs(sym->value().c_str(), 1, list->count() - 1);
     return list->item(1);
 }
 
@@ -232,14 +269,14 @@ static malValuePtr quasiquote(malValuePtr obj)
     if (!seq)
         return obj;
 
-    const malValuePtr unquoted = starts_with(obj, "unquote");
+    const malValuePtr unquoted = starts_with(obj, s_unquote);
     if (unquoted)
         return unquoted;
 
-    malValuePtr res = mal::list(new malValueVec(0));
+    malValuePtr res = malValuePtr(malList::create(0));
     for (int i=seq->count()-1; 0<=i; i--) {
         const malValuePtr elt     = seq->item(i);
-        const malValuePtr spl_unq = starts_with(elt, "splice-unquote");
+        const malValuePtr spl_unq = starts_with(elt, s_spliceUnquote);
         if (spl_unq)
             res = mal::list(mal::symbol("concat"), spl_unq, res);
          else
@@ -253,8 +290,6 @@ static malValuePtr quasiquote(malValuePtr obj)
 static const char* malFunctionTable[] = {
     "(defmacro! cond (fn* (& xs) (if (> (count xs) 0) (list 'if (first xs) (if (> (count xs) 1) (nth xs 1) (throw \"odd number of forms to cond\")) (cons 'cond (rest (rest xs)))))))",
     "(def! not (fn* (cond) (if cond false true)))",
-    "(def! load-file (fn* (filename) \
-        (eval (read-string (str \"(do \" (slurp filename) \"\nnil)\")))))",
 };
 
 static void installFunctions(malEnvPtr env) {